@@ -0,0 +1,397 @@
+#include "gc.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// exercises the collector on its own: every scenario builds a heap of a particular shape in a
+// heap of its own, then alternates between changing it and collecting it. prints the results as
+// json. "gc_bench <scale>" multiplies the sizes of every scenario
+
+
+using clock_type = std::chrono::steady_clock;
+
+
+struct list_node {
+    gc::ptr<list_node> next;
+    std::int64_t value = 0;
+
+    void transverse(gc::action &act) { act(next); }
+};
+
+
+// no ptrs and nothing to destroy, so marking and freeing one skip its transverse and destroy
+struct leaf_node {
+    std::int64_t value = 0;
+};
+
+
+// a node holding a gc::allocator block, so making one takes a block from the bins too
+struct blob_node {
+    std::vector<char, gc::allocator<char>> data;
+};
+
+
+using wide_map = std::unordered_map<std::int64_t, gc::ptr<list_node>, std::hash<std::int64_t>,
+      std::equal_to<std::int64_t>, gc::allocator<std::pair<const std::int64_t, gc::ptr<list_node>>>>;
+
+
+struct result {
+    std::string name;
+    std::size_t allocations = 0;
+    clock_type::duration allocation_time{0};
+    std::size_t nodes_collected = 0;    // every node a collection had to consider, live or not
+    std::vector<clock_type::duration> pauses;
+};
+
+
+double seconds(clock_type::duration d) { return std::chrono::duration<double>(d).count(); }
+
+
+// times one step that makes count objects
+template<typename Func>
+void allocate(result &r, std::size_t count, Func &&func) {
+    clock_type::time_point start = clock_type::now();
+    func();
+    r.allocation_time += clock_type::now() - start;
+    r.allocations += count;
+}
+
+
+void collect(result &r) {
+    r.nodes_collected += gc::object_count();
+    clock_type::time_point start = clock_type::now();
+    gc::collect();
+    r.pauses.push_back(clock_type::now() - start);
+}
+
+
+// short-lived objects: most are dropped as soon as they're made, one in ten lives for a round
+result allocation_heavy(std::size_t scale) {
+    result r;
+    r.name = "allocation_heavy";
+    gc::anchor<std::vector<gc::ptr<list_node>>> kept;
+
+    for(std::size_t round = 0; round < 50; ++round) {
+        allocate(r, 100000 * scale, [&] {
+            kept->clear();
+            for(std::size_t i = 0; i < 100000 * scale; ++i) {
+                gc::ptr<list_node> p = gc::make_ptr<list_node>();
+                p->value = i;
+                if(i % 10 == 0)
+                    kept->push_back(std::move(p));
+            }
+        });
+        collect(r);
+    }
+    return r;
+}
+
+
+// the slab pools on their own: nodes made and freed by refcounting a few at a time, so slots are
+// reused as fast as they're freed, with a live heap of short chains for every collection to mark
+result pool_churn(std::size_t scale) {
+    result r;
+    r.name = "pool_churn";
+    gc::anchor<std::vector<gc::ptr<list_node>>> chains;
+    std::size_t live = 100000 * scale;
+
+    allocate(r, live, [&] {
+        for(std::size_t i = 0; i < live / 100; ++i) {
+            gc::ptr<list_node> head;
+            for(std::size_t j = 0; j < 100; ++j) {
+                gc::ptr<list_node> p = gc::make_ptr<list_node>();
+                p->next = std::move(head);
+                head = std::move(p);
+            }
+            chains->push_back(std::move(head));
+        }
+    });
+
+    for(std::size_t round = 0; round < 50; ++round) {
+        allocate(r, 200000 * scale, [&] {
+            gc::ptr<list_node> recent[64];
+            for(std::size_t i = 0; i < 200000 * scale; ++i) {
+                recent[i % 64] = gc::make_ptr<list_node>();
+                recent[i % 64]->value = i;
+            }
+        });
+        collect(r);
+    }
+    return r;
+}
+
+
+// the bins under several threads at once, each making nodes with blocks of up to 2 KiB in a heap
+// of its own and keeping one in ten for a round. allocations_per_sec is for all of them together:
+// the allocation time is the longest any one thread spent
+result threaded_blocks(std::size_t scale) {
+    constexpr std::size_t thread_count = 4;
+    std::vector<result> results(thread_count);
+    std::vector<std::thread> threads;
+
+    for(std::size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&results, t, scale] {
+            gc::heap h;
+            gc::heap_scope scope(h);
+            result &r = results[t];
+            gc::anchor<std::vector<gc::ptr<blob_node>>> kept;
+
+            for(std::size_t round = 0; round < 20; ++round) {
+                allocate(r, 2 * 50000 * scale, [&] {
+                    kept->clear();
+                    for(std::size_t i = 0; i < 50000 * scale; ++i) {
+                        gc::ptr<blob_node> p = gc::make_ptr<blob_node>();
+                        p->data.resize((i * 37 + t) % 2048 + 1);
+                        if(i % 10 == 0)
+                            kept->push_back(std::move(p));
+                    }
+                });
+                collect(r);
+            }
+        });
+    }
+    for(std::thread &thread : threads)
+        thread.join();
+
+    result r;
+    r.name = "threaded_blocks";
+    for(const result &own : results) {
+        r.allocations += own.allocations;
+        r.allocation_time = std::max(r.allocation_time, own.allocation_time);
+        r.nodes_collected += own.nodes_collected;
+        r.pauses.insert(r.pauses.end(), own.pauses.begin(), own.pauses.end());
+    }
+    return r;
+}
+
+
+// garbage that only a collection can free: rings of two that are dropped right away
+result cycle_heavy(std::size_t scale) {
+    result r;
+    r.name = "cycle_heavy";
+    gc::anchor<std::vector<gc::ptr<list_node>>> kept;
+
+    allocate(r, 10000 * scale, [&] {
+        for(std::size_t i = 0; i < 10000 * scale; ++i)
+            kept->push_back(gc::make_ptr<list_node>());
+    });
+
+    for(std::size_t round = 0; round < 50; ++round) {
+        allocate(r, 40000 * scale, [&] {
+            for(std::size_t i = 0; i < 20000 * scale; ++i) {
+                gc::ptr<list_node> a = gc::make_ptr<list_node>();
+                a->next = gc::make_ptr<list_node>();
+                a->next->next = a;
+            }
+        });
+        collect(r);
+    }
+    return r;
+}
+
+
+// a single long chain, so marking can't do anything but follow it
+result deep_linked_list(std::size_t scale) {
+    result r;
+    r.name = "deep_linked_list";
+    gc::anchor_ptr<list_node> head;
+    gc::anchor_ptr<list_node> cut;      // where the tail that's replaced every round starts
+    std::size_t length = 1000000 * scale;
+
+    allocate(r, length, [&] {
+        head = gc::make_anchor_ptr<list_node>();
+        gc::ptr<list_node> tail = head;
+        for(std::size_t i = 1; i < length; ++i) {
+            tail->next = gc::make_ptr<list_node>();
+            tail = tail->next;
+            if(i == length - 1000)
+                cut = tail;
+        }
+    });
+
+    for(std::size_t round = 0; round < 20; ++round) {
+        allocate(r, 1000, [&] {
+            gc::ptr<list_node> p = cut;
+            for(std::size_t i = 0; i < 1000; ++i) {
+                p->next = gc::make_ptr<list_node>();
+                p = p->next;
+            }
+        });
+        collect(r);
+    }
+
+    // frees the chain by refcounting before the heap goes, which isn't part of the benchmark
+    cut = nullptr;
+    head = nullptr;
+    return r;
+}
+
+
+// a great many leaves, some of which are replaced every round. marking sets their bits without
+// putting them on the mark stack
+result leaf_heavy(std::size_t scale) {
+    result r;
+    r.name = "leaf_heavy";
+    gc::anchor<std::vector<gc::ptr<leaf_node>>> leaves;
+    std::size_t size = 1000000 * scale;
+
+    allocate(r, size, [&] {
+        leaves->reserve(size);
+        for(std::size_t i = 0; i < size; ++i)
+            leaves->push_back(gc::make_ptr<leaf_node>());
+    });
+
+    for(std::size_t round = 0; round < 20; ++round) {
+        allocate(r, size / 50, [&] {
+            for(std::size_t i = 0; i < size / 50; ++i) {
+                gc::ptr<leaf_node> p = gc::make_ptr<leaf_node>();
+                p->value = i;
+                (*leaves)[(round * 7919 + i * 104729) % size] = std::move(p);
+            }
+        });
+        collect(r);
+    }
+    return r;
+}
+
+
+// incremental marking of a heap of short chains while their heads are replaced, through deferred ptrs
+// on an anchored stack the way the interpreter uses them. a slice runs on every allocation as well as
+// on every step(), so each slice is a pause of its own: they're read back from the heap's stats. the
+// allocation time includes the slices allocations ran
+result incremental_marking(std::size_t scale) {
+    result r;
+    r.name = "incremental_marking";
+    gc::anchor<std::vector<gc::ptr<list_node>>> chains;
+    gc::anchor<std::vector<gc::ptr<list_node>>> stack;
+    std::size_t count = 5000 * scale;
+
+    allocate(r, count * 100, [&] {
+        for(std::size_t i = 0; i < count; ++i) {
+            gc::ptr<list_node> head;
+            for(std::size_t j = 0; j < 100; ++j) {
+                gc::ptr<list_node> p = gc::make_ptr<list_node>();
+                p->next = std::move(head);
+                head = std::move(p);
+            }
+            chains->push_back(std::move(head));
+        }
+    });
+
+    gc::set_deferred_rc(true, 1000);
+    gc::set_incremental(true);
+    gc::set_incremental_start(0);
+    gc::set_slice_budget(1000, std::chrono::microseconds(200));
+    stack->push_back(gc::defer((*chains)[0]));     // so the heads replaced wait in the zct
+
+    gc::stats last = gc::get_stats();
+    auto record_slices = [&] {
+        gc::stats now = gc::get_stats();
+        if(now.incremental_slices != last.incremental_slices)
+            r.pauses.push_back(now.last_pause);
+        if(now.collections != last.collections)
+            r.nodes_collected += gc::object_count();
+        last = now;
+    };
+
+    for(std::size_t round = 0; last.collections < 20; ++round) {
+        for(std::size_t i = 0; i < 100; ++i) {
+            allocate(r, 1, [&] {
+                gc::ptr<list_node> &head = (*chains)[(round * 7919 + i * 104729) % count];
+                stack->push_back(gc::defer(head));
+                gc::ptr<list_node> p = gc::make_ptr<list_node>();
+                p->next = stack->back()->next;
+                head = std::move(p);
+                stack->pop_back();
+            });
+            record_slices();
+        }
+        gc::step();
+        record_slices();
+    }
+
+    stack->clear();
+    gc::set_incremental(false);
+    return r;
+}
+
+
+// one object with a great many children, some of which are replaced every round
+result wide_map_heap(std::size_t scale) {
+    result r;
+    r.name = "wide_map";
+    gc::anchor<wide_map> map;
+    std::size_t size = 500000 * scale;
+
+    allocate(r, size, [&] {
+        for(std::size_t i = 0; i < size; ++i)
+            map->emplace(i, gc::make_ptr<list_node>());
+    });
+
+    for(std::size_t round = 0; round < 20; ++round) {
+        allocate(r, size / 50, [&] {
+            for(std::size_t i = 0; i < size / 50; ++i) {
+                gc::ptr<list_node> p = gc::make_ptr<list_node>();
+                p->next = p;    // a cycle, so the old one waits for the collection
+                (*map)[(round * 7919 + i * 104729) % size] = std::move(p);
+            }
+        });
+        collect(r);
+    }
+    return r;
+}
+
+
+double pause_percentile(std::vector<clock_type::duration> pauses, double percentile) {
+    if(pauses.empty())
+        return 0;
+    std::sort(pauses.begin(), pauses.end());
+    std::size_t index = std::min(pauses.size() - 1, static_cast<std::size_t>(percentile / 100 * pauses.size()));
+    return std::chrono::duration<double, std::micro>(pauses[index]).count();
+}
+
+
+void print_json(const std::vector<result> &results) {
+    std::printf("{\n  \"scenarios\": [\n");
+    for(std::size_t i = 0; i < results.size(); ++i) {
+        const result &r = results[i];
+        clock_type::duration total_pause{0};
+        for(clock_type::duration pause : r.pauses)
+            total_pause += pause;
+
+        std::printf("    {\"name\": \"%s\", \"allocations\": %zu, \"allocations_per_sec\": %.0f, "
+                "\"collections\": %zu, \"collected_nodes_per_sec\": %.0f, "
+                "\"pause_us\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}}%s\n",
+                r.name.c_str(), r.allocations, r.allocations / seconds(r.allocation_time),
+                r.pauses.size(), r.nodes_collected / seconds(total_pause),
+                pause_percentile(r.pauses, 50), pause_percentile(r.pauses, 99), pause_percentile(r.pauses, 100),
+                i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
+
+
+int main(int argc, char *argv[]) {
+    std::size_t scale = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1;
+    std::vector<result> results;
+
+    for(result (*scenario)(std::size_t) : {allocation_heavy, pool_churn, threaded_blocks, cycle_heavy,
+            deep_linked_list, leaf_heavy, incremental_marking, wide_map_heap}) {
+        gc::heap h;
+        gc::heap_scope scope(h);
+        results.push_back(scenario(scale));
+    }
+
+    print_json(results);
+}
@@ -0,0 +1,266 @@
+#include "compiler.hpp"
+#include "gc.hpp"
+#include "interpreter.hpp"
+#include "memory.hpp"
+#include "object.hpp"
+#include "tokenizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// how much room the interpreter's values take and how fast it runs loops over them. the sizes are
+// what gc::get_memory_used() grows by per element, so they include the gc::allocator storage and
+// nodes the elements own. the maps section times gcmap inserts, lookups and iteration next to the
+// std::unordered_map it used to be, in nanoseconds per entry. prints json. "object_bench <scale>"
+// multiplies the loop counts. built with GC_COUNT_REFS defined (make bench-refs), it also reports
+// the ref_count changes each loop iteration makes
+
+
+using clock_type = std::chrono::steady_clock;
+
+
+struct element_size {
+    const char *name;
+    double bytes;
+};
+
+
+struct loop_result {
+    const char *name;
+    std::size_t iterations;
+    double iterations_per_sec;
+    double ref_ops_per_iteration;
+};
+
+
+struct map_result {
+    const char *type;
+    std::size_t entries;
+    double insert_ns;
+    double lookup_ns;
+    double iterate_ns;
+};
+
+
+using unordered_gcmap = std::unordered_map<string_ref, object, string_ref_hash, string_ref_equal,
+      gc::allocator<std::pair<const string_ref, object>>>;
+
+
+volatile std::size_t map_sink;    // keeps the lookups and iteration from being optimized away
+
+
+template<typename Func>
+element_size measure_size(const char *name, std::size_t count, Func &&func) {
+    gc::collect();
+    std::size_t before = gc::get_memory_used();
+    gc::anchor<std::vector<object>> kept;
+    func(*kept, count);
+    return {name, static_cast<double>(gc::get_memory_used() - before) / count};
+}
+
+
+std::vector<element_size> element_sizes() {
+    std::vector<element_size> sizes;
+    std::size_t count = 100000;
+
+    sizes.push_back(measure_size("array_int", count, [](std::vector<object> &kept, std::size_t n) {
+        array_ref arr = make_array();
+        arr->reserve(n);
+        for(std::size_t i = 0; i < n; ++i)
+            arr->push_back(object(static_cast<std::int64_t>(i)));
+        kept.push_back(object(arr));
+    }));
+
+    sizes.push_back(measure_size("array_double", count, [](std::vector<object> &kept, std::size_t n) {
+        array_ref arr = make_array();
+        arr->reserve(n);
+        for(std::size_t i = 0; i < n; ++i)
+            arr->push_back(object(i * 0.5));
+        kept.push_back(object(arr));
+    }));
+
+    sizes.push_back(measure_size("array_short_string", count, [](std::vector<object> &kept, std::size_t n) {
+        array_ref arr = make_array();
+        arr->reserve(n);
+        for(std::size_t i = 0; i < n; ++i)
+            arr->push_back(object(make_string(std::to_string(i))));
+        kept.push_back(object(arr));
+    }));
+
+    sizes.push_back(measure_size("map_int", count, [](std::vector<object> &kept, std::size_t n) {
+        map_ref map = make_map();
+        map->reserve(n);
+        for(std::size_t i = 0; i < n; ++i)
+            map->try_emplace(make_string(std::to_string(i)), object(static_cast<std::int64_t>(i)));
+        kept.push_back(object(map));
+    }));
+
+    sizes.push_back(measure_size("variable", count, [](std::vector<object> &kept, std::size_t n) {
+        kept.reserve(n);
+        for(std::size_t i = 0; i < n; ++i)
+            kept.push_back(object(make_lvalue(static_cast<std::int64_t>(i))));
+        kept.shrink_to_fit();
+    }));
+
+    // the operand stack itself isn't gc::allocator memory
+    sizes.push_back({"operand", static_cast<double>(sizeof(object))});
+    return sizes;
+}
+
+
+loop_result run_loop(compiler &c, interpreter &i, const char *name, std::size_t iterations, const std::string &body) {
+    std::string code = "n = " + std::to_string(iterations) + "; " + body;
+    clock_type::duration best = clock_type::duration::max();
+    std::size_t ref_ops = 0;
+
+    for(int run = 0; run < 3; ++run) {
+        tokenizer t(code);
+        std::shared_ptr<func_def> program = c.compile(t.tokens(), t.source(), false);
+        gc::stats before = gc::get_stats();
+        clock_type::time_point start = clock_type::now();
+        i.execute(std::move(program));
+        best = std::min(best, clock_type::now() - start);
+        gc::stats after = gc::get_stats();
+        ref_ops = after.ref_increments - before.ref_increments + after.ref_decrements - before.ref_decrements;
+    }
+
+    return {name, iterations, iterations / std::chrono::duration<double>(best).count(), 
+        static_cast<double>(ref_ops) / iterations};
+}
+
+
+template<typename Func>
+double best_ns_per_op(std::size_t ops, Func &&func) {
+    clock_type::duration best = clock_type::duration::max();
+    for(int run = 0; run < 3; ++run) {
+        clock_type::time_point start = clock_type::now();
+        func();
+        best = std::min(best, clock_type::now() - start);
+    }
+    return std::chrono::duration<double, std::nano>(best).count() / ops;
+}
+
+
+template<typename Map>
+map_result time_map(const char *type, std::size_t entries, std::size_t scale) {
+    // lookups are by other strings with the same text, as a script's mostly are
+    gc::anchor<std::vector<string_ref>> keys, probes;
+    for(std::size_t i = 0; i < entries; ++i) {
+        std::string text = "key" + std::to_string(i);
+        keys->push_back(make_string(text));
+        probes->push_back(make_string(text));
+        keys->back()->hash();
+        probes->back()->hash();
+    }
+
+    std::size_t rounds = std::max<std::size_t>(1, 1000000 * scale / entries);
+    std::size_t ops = rounds * entries;
+    auto fill = [&](Map &map) {
+        for(std::size_t i = 0; i < entries; ++i)
+            map.try_emplace((*keys)[i], object(static_cast<std::int64_t>(i)));
+    };
+
+    double insert_ns = best_ns_per_op(ops, [&] {
+        for(std::size_t r = 0; r < rounds; ++r)
+            fill(*gc::make_ptr<Map>());
+    });
+
+    gc::ptr<Map> map = gc::make_ptr<Map>();
+    fill(*map);
+
+    double lookup_ns = best_ns_per_op(ops, [&] {
+        std::size_t found = 0;
+        for(std::size_t r = 0; r < rounds; ++r) {
+            for(const string_ref &probe : *probes)
+                found += map->find(probe) != map->end();
+        }
+        map_sink = found;
+    });
+
+    double iterate_ns = best_ns_per_op(ops, [&] {
+        std::size_t total = 0;
+        for(std::size_t r = 0; r < rounds; ++r) {
+            for(const auto &entry : *map)
+                total += entry.first->size();
+        }
+        map_sink = total;
+    });
+
+    return {type, entries, insert_ns, lookup_ns, iterate_ns};
+}
+
+
+std::vector<map_result> maps(std::size_t scale) {
+    std::vector<map_result> results;
+    for(std::size_t entries : {10, 1000, 1000000}) {
+        results.push_back(time_map<gcmap>("gcmap", entries, scale));
+        results.push_back(time_map<unordered_gcmap>("unordered_map", entries, scale));
+        gc::collect();
+    }
+    return results;
+}
+
+
+std::vector<loop_result> loops(std::size_t scale) {
+    memory m;
+    compiler c(&m);
+    interpreter i(&m, 100);
+    std::size_t n = 1000000 * scale;
+
+    return {
+        run_loop(c, i, "count", n, "i = 0; while(i < n) { ++i; } i"),
+        run_loop(c, i, "float_arith", n, "i = 0; t = 0.5; while(i < n) { t = t * 0.5 + i; ++i; } t"),
+        run_loop(c, i, "array_update", n,
+                "a = [0, 0, 0, 0, 0, 0, 0, 0]; i = 0; while(i < n) { a[i & 7] = a[i & 7] + i; ++i; } a[0]"),
+        run_loop(c, i, "map_update", n, "m = {x: 0, y: 1}; i = 0; while(i < n) { m[\"x\"] = m[\"x\"] + i; ++i; } m[\"x\"]"),
+        run_loop(c, i, "call", n / 4, "f = fn(x) { return x + 1; }; i = 0; while(i < n) { i = f(i); } i"),
+        run_loop(c, i, "map_string_keys", n, 
+                "ks = [\"alpha\", \"beta\", \"gamma\", \"delta\"]; m = {alpha: 0, beta: 0, gamma: 0, delta: 0}; "
+                "i = 0; while(i < n) { k = ks[i & 3]; m[k] = m[k] + 1; ++i; } m[\"beta\"]"),
+        run_loop(c, i, "map_int_keys", n, "m = {}; i = 0; while(i < n) { m[i & 1023] = i; ++i; } m[5]"),
+        run_loop(c, i, "string_concat", n, "s = \"\"; i = 0; while(i < n) { s = \"item \" + i; ++i; } s"),
+        run_loop(c, i, "string_compare", n, 
+                "a = \"hello world\"; b = \"hello \" + \"world\"; i = 0; c = 0; while(i < n) { if(a == b) { ++c; } ++i; } c"),
+        run_loop(c, i, "string_append_1mb", 1 << 20, "s = \"\"; i = 0; while(i < n) { s += \"x\"; ++i; } i"),
+        // the second += follows one whose value last_value still holds
+        run_loop(c, i, "string_append_pairs", 1 << 19, "s = \"\"; i = 0; while(i < n) { ++i; s += \"x\"; s += \"y\"; } i")
+    };
+}
+
+
+int main(int argc, char *argv[]) {
+    std::size_t scale = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1;
+    std::vector<element_size> sizes = element_sizes();
+    std::vector<loop_result> results = loops(scale);
+    std::vector<map_result> map_results = maps(scale);
+
+    std::printf("{\n  \"bytes_per_element\": {");
+    for(std::size_t i = 0; i < sizes.size(); ++i)
+        std::printf("%s\"%s\": %.1f", i ? ", " : "", sizes[i].name, sizes[i].bytes);
+
+    std::printf("},\n  \"loops\": [\n");
+    for(std::size_t i = 0; i < results.size(); ++i) {
+        std::printf("    {\"name\": \"%s\", \"iterations\": %zu, \"iterations_per_sec\": %.0f",
+                results[i].name, results[i].iterations, results[i].iterations_per_sec);
+#ifdef GC_COUNT_REFS
+        std::printf(", \"ref_ops_per_iteration\": %.2f", results[i].ref_ops_per_iteration);
+#endif
+        std::printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    std::printf("  ],\n  \"maps\": [\n");
+    for(std::size_t i = 0; i < map_results.size(); ++i) {
+        const map_result &m = map_results[i];
+        std::printf("    {\"type\": \"%s\", \"entries\": %zu, \"insert_ns\": %.1f, \"lookup_ns\": %.1f, \"iterate_ns\": %.1f}%s\n",
+                m.type, m.entries, m.insert_ns, m.lookup_ns, m.iterate_ns, i + 1 < map_results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+}
@@ -29,6 +29,8 @@ inline std::string to_std_string(const gcstring &str) {
     return std::string(str.begin(), str.end());
 }
 
+inline std::string to_std_string(const string_type &str) { return std::string(str.view()); }
+
 inline gcstring to_gcstring(const std::string &str) {
     return gcstring(str.begin(), str.end());
 }
@@ -46,13 +48,13 @@ inline std::optional<gcstring> to_optional_string(std::int64_t v,   std::size_t
     return to_gcstring(std::to_string(v)); 
 }
 
-std::optional<gcstring> to_optional_string(const string_ref &s,     std::size_t = 0, std::size_t* = nullptr, bool format = false);
+std::optional<gcstring> to_optional_string(const string_type &s,    std::size_t = 0, std::size_t* = nullptr, bool format = false);
 std::optional<gcstring> to_optional_string(double v,                std::size_t = 0, std::size_t* = nullptr, bool = false);
 
-std::optional<gcstring> to_optional_string(const array_ref &ref,    std::size_t = 0, std::size_t* = nullptr, bool = false);
-std::optional<gcstring> to_optional_string(const map_ref &ref,      std::size_t = 0, std::size_t* = nullptr, bool = false);
+std::optional<gcstring> to_optional_string(const gcvector<object> &arr, std::size_t = 0, std::size_t* = nullptr, bool = false);
+std::optional<gcstring> to_optional_string(const gcmap &map,        std::size_t = 0, std::size_t* = nullptr, bool = false);
 
-std::optional<gcstring> to_optional_string(const func_ref &, std::size_t = 0, std::size_t* = nullptr, bool = false);
+std::optional<gcstring> to_optional_string(const func_type &, std::size_t = 0, std::size_t* = nullptr, bool = false);
 
 
 template<typename T>
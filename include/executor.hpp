@@ -17,6 +17,10 @@ bool binary_comp(op_code code, const object &left, const object &right);
 object binary_int_op(op_code code, const object &left, const object &right);
 object binary_arithmetic(op_code code, const object &left, const object &right);
 
+// left += right, done by appending to the string left refers to in place, if that string isn't shared
+// with anything but replaced (a value about to be replaced anyway). false if it can't be
+bool append_assign(const object &left, const object &right, const object &replaced);
+
 object index_op(memory *mem, const object &left, const object &right);
 
 bool unary_op(gc::anchor<object> &last_value, std::vector<object> &operands, std::size_t parent_operand_count, op_code code);
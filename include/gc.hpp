@@ -2,21 +2,127 @@
 #define LIPH_GC_HPP
 
 #include "gc_detail.hpp"
+#include <chrono>
 #include <functional>
 #include <new>
-#include <typeinfo>
 
 
 namespace gc {
  
 
+// every thread starts out using the process-wide default heap. the functions below act on the
+// calling thread's current heap
+heap &get_current_heap() noexcept;
+heap *set_current_heap(heap &h) noexcept;   // returns the previous one
+
 std::size_t object_count();
 std::size_t anchor_count();
+stats get_stats();
 
 std::size_t get_memory_used();
 std::size_t get_memory_limit();
 void set_memory_limit(std::size_t limit);
 
+// see heap::set_allocation_budget
+void set_allocation_budget(std::size_t bytes);
+void clear_allocation_budget();
+std::size_t get_bytes_allocated();
+
+// incremental mode: once memory used reaches the start percentage of the memory limit, step() begins
+// a marking cycle which then advances in slices of at most max_nodes objects or max_time, on each
+// allocation and each call to step(), instead of in one stop-the-world pass
+void set_incremental(bool enabled);
+bool is_incremental();
+void set_incremental_start(std::size_t percent_of_limit);
+void set_slice_budget(std::size_t max_nodes, std::chrono::microseconds max_time);
+void step();
+
+// with more than one thread, a full collect() of a heap with at least min_nodes objects
+// marks on that many threads
+void set_parallel_mark(std::size_t threads, std::size_t min_nodes);
+
+// collections paced by heap growth, see heap::set_pacing
+void set_pacing(bool enabled, std::size_t growth_percent, std::size_t min_bytes, std::size_t max_bytes);
+
+// trial deletion of garbage cycles, see heap::set_cycle_collection
+void set_cycle_collection(bool enabled, std::size_t max_candidates);
+void collect_cycles();
+
+// deferred reference counting: gc::defer makes ptrs that don't add to the ref_count, and nodes
+// whose count drops to 0 meanwhile are only freed once no deferred ptr refers to them
+void set_deferred_rc(bool enabled, std::size_t max_pending);
+
+// lazy freeing, see heap::set_lazy_free. free_slice() destroys one slice of the queued objects
+// and returns true once none are left, for callers with nothing better to do
+void set_lazy_free(bool enabled, std::size_t slice_nodes);
+bool free_slice();
+
+
+// makes a heap the calling thread's current heap for the lifetime of the scope
+class heap_scope {
+public:
+    explicit heap_scope(heap &h) noexcept : previous(set_current_heap(h)) {}
+    ~heap_scope() { set_current_heap(*previous); }
+
+    heap_scope(const heap_scope &) = delete;
+    heap_scope &operator=(const heap_scope &) = delete;
+
+private:
+    heap *previous;
+};
+
+
+namespace detail {
+
+
+// what a ptr does to its node when it's copied (a deferred reference becomes a counted one), when it
+// goes away, and when its reference leaves its slot. see object for a value that keeps a node itself
+inline node *add_ref(node *n) noexcept {
+    n = untag(n);
+    if(n) {
+        ++n->ref_count;
+#ifdef GC_COUNT_REFS
+        ++current_heap->counters.ref_increments;
+#endif
+    }
+    return n;
+}
+
+
+inline void remove_ref(node *n) {
+    heap &h = *current_heap;
+#ifdef GC_COUNT_REFS
+    if(!is_deferred(n))
+        ++h.counters.ref_decrements;
+#endif
+    if(is_deferred(n)) {
+        // the node may have been copied somewhere marking has already been through
+        if(h.is_marking)
+            h.shade(untag(n));
+        if(--h.deferred_refs == 0 && h.zct != &zct_end && !h.is_running)
+            h.release_zct();
+    } else if(!h.is_running) {
+        if(--n->ref_count == 0) {
+            n->free();
+        } else {
+            h.add_candidate(n);
+            if(h.is_marking)
+                h.shade(n);
+        }
+    }
+}
+
+
+// while an incremental collection is marking, a reference that leaves its current slot
+// keeps its target alive for the rest of the cycle (snapshot-at-the-beginning)
+inline void write_barrier(node *n) noexcept {
+    if(n && current_heap->is_marking)
+        current_heap->shade(untag(n));
+}
+
+
+}  // namespace detail
+
 
 template<typename T>
 class ptr;
@@ -24,6 +130,17 @@ class ptr;
 template<typename T>
 class anchor;
 
+namespace detail {
+    template<typename T>
+    node *release_node(ptr<T> &&p) noexcept;
+
+    template<typename T>
+    ptr<T> ptr_from_node(node *n) noexcept;
+}
+
+template<typename T>
+class weak_ptr;
+
 template<typename... Types>
 struct for_types {};
 
@@ -51,9 +168,9 @@ private:
         bool detail_perform(detail::node *node) override { 
             if(debug && !node)
                 throw std::logic_error("custom_action: null");
-            node->mark_reachable();
+            bool first_visit = detail::pool_mark(node);
             run_on_node(node, func);
-            return true;
+            return first_visit;
         }
 
         Func &func;
@@ -62,33 +179,30 @@ private:
 public:
     template<typename Func>
     static void iterate_all_objects(Func &&func) {
-        detail::node *n = detail::active_head.next;
-
-        while(n != &detail::active_head) {
-            run_on_node(n, std::forward<Func>(func));    
-            n = n->next;
-        }
+        detail::current_heap->pool.for_each_live([&](void *slot) {
+            run_on_node(static_cast<detail::node*>(slot), func);
+        });
     }
 
     
     template<typename T, typename Func>
     static void iterate_from(ptr<T> &p, Func &&func) {
+        heap &h = *detail::current_heap;
+        h.cancel_marking();
         custom_action<Func> act(func);
-        detail::transverse_and_mark_reachable(p.n, act);
-        debug_out("iterate_from: ptr: resetting reachable flag");
-        detail::reset_reachable_flag(detail::temp_head);
-        detail::move_temp_to_active();
+        detail::transverse_and_mark_reachable(detail::untag(p.n), act);
+        h.pool.clear_marks();
     }
 
 
     // TODO: const overload?
     template<typename T, typename Func>
     static void iterate_from(anchor<T> &n, Func &&func) {
+        heap &h = *detail::current_heap;
+        h.cancel_marking();
         custom_action<Func> act(func);
         detail::transverse_and_mark_reachable(n, act);
-        debug_out("iterate_from: anchor: resetting reachable flag");
-        detail::reset_reachable_flag(detail::temp_head);
-        detail::move_temp_to_active();
+        h.pool.clear_marks();
     }
 
 private:
@@ -97,7 +211,7 @@ private:
 
     template<typename Func>
     static bool run_on_node(detail::node *n, Func &&func) {
-        if(typeid(detail::object<Type>&) == typeid(*n)) {
+        if(n->type == detail::node_type_index<Type>()) {
             func(static_cast<detail::object<Type>*>(n)->value);
             return true;
         } else {
@@ -129,9 +243,10 @@ public:
         p = &obj->value;
     }
 
-    ptr(const ptr &other) noexcept : n(other.n), p(other.p) { if(n) ++n->ref_count; }
+    ptr(const ptr &other) noexcept : n(detail::add_ref(other.n)), p(other.p) {}
 
     ptr(ptr &&other) noexcept : n(other.n), p(other.p) { 
+        other.write_barrier();
         other.n = nullptr;
         other.p = nullptr;
     }
@@ -148,16 +263,16 @@ public:
     }
 
     ptr &operator=(const ptr &other) {
-        if(other.n)
-            ++other.n->ref_count;
+        detail::node *other_n = detail::add_ref(other.n);
         reset();
-        n = other.n;
+        n = other_n;
         p = other.p;
         return *this;
     }
 
     ptr &operator=(ptr &&other) {
         reset();
+        other.write_barrier();
         n = other.n;
         p = other.p;
         other.n = nullptr;
@@ -190,16 +305,18 @@ public:
         return *p; 
     }
     
-    std::size_t use_count() const noexcept { return n ? n->ref_count : 0; }
+    std::size_t use_count() const noexcept { return n ? detail::untag(n)->ref_count : 0; }
 
     void swap(ptr &other) noexcept {
+        write_barrier();
+        other.write_barrier();
         std::swap(n, other.n);
         std::swap(p, other.p);
     }
 
     void reset() {
-        if(n && !detail::is_running && --n->ref_count == 0)
-            n->free();
+        if(n)
+            detail::remove_ref(n);
         n = nullptr;
         p = nullptr;
     }
@@ -226,8 +343,22 @@ protected:
     template<typename... Types>
     friend struct for_types;
 
+    template<typename U>
+    friend ptr<U> defer(const ptr<U> &p) noexcept;
 
-    ptr(detail::node *n, T *p) noexcept : n(n), p(p) { if(n) ++n->ref_count; }
+    template<typename U>
+    friend class weak_ptr;
+
+    template<typename U>
+    friend detail::node *detail::release_node(ptr<U> &&p) noexcept;
+
+    template<typename U>
+    friend ptr<U> detail::ptr_from_node(detail::node *n) noexcept;
+
+
+    ptr(detail::node *n, T *p) noexcept : n(detail::add_ref(n)), p(p) {}
+
+    void write_barrier() const noexcept { detail::write_barrier(n); }
 
 
     template<typename... Args>
@@ -242,6 +373,120 @@ protected:
 
 
 
+// a ptr to the same object that doesn't add to its ref_count, for values the interpreter keeps on
+// its own stacks. it may only be kept in an anchor or a gc::root (directly or in a container they
+// hold), since that's where the collector looks for it; moving it keeps it deferred, copying it
+// gives an ordinary ptr. with deferred reference counting off, this is a plain copy (or move)
+template<typename T>
+ptr<T> defer(const ptr<T> &p) noexcept {
+    heap &h = *detail::current_heap;
+    if(!p.n || !h.deferred_rc)
+        return p;
+
+    ptr<T> result;
+    result.n = reinterpret_cast<detail::node*>(reinterpret_cast<std::uintptr_t>(detail::untag(p.n)) | detail::deferred_tag);
+    result.p = p.p;
+    ++h.deferred_refs;
+    return result;
+}
+
+template<typename T>
+ptr<T> defer(ptr<T> &&p) noexcept {
+    if(!detail::current_heap->deferred_rc)
+        return std::move(p);
+    return defer(static_cast<const ptr<T>&>(p));
+}
+
+
+
+namespace detail {
+
+
+// the reference p holds, handed over as its node (with the deferred tag if it has one)
+template<typename T>
+node *release_node(ptr<T> &&p) noexcept {
+    p.write_barrier();
+    p.p = nullptr;
+    return std::exchange(p.n, nullptr);
+}
+
+
+// a new ptr to the value of a node made for a T, as if copied from the ptr the node came from
+template<typename T>
+ptr<T> ptr_from_node(node *n) noexcept {
+    n = untag(n);
+    return ptr<T>(n, n ? &static_cast<object<T>*>(n)->value : nullptr);
+}
+
+
+}  // namespace detail
+
+
+
+// refers to an object without keeping it alive. lock() gives a ptr to it, or null once its count
+// has dropped to 0 or a collection has found it unreachable. weak_ptrs compare and hash by the
+// block they share, so they stay usable as keys after their object is gone
+template<typename T>
+class weak_ptr {
+public:
+    weak_ptr() noexcept : block(nullptr), p(nullptr) {}
+    weak_ptr(std::nullptr_t) noexcept : block(nullptr), p(nullptr) {}
+
+    weak_ptr(const ptr<T> &other) : block(nullptr), p(other.p) {
+        if(other.n)
+            block = detail::current_heap->acquire_weak(detail::untag(other.n));
+    }
+
+    weak_ptr(const weak_ptr &other) noexcept : block(other.block), p(other.p) { if(block) ++block->weak_count; }
+
+    weak_ptr(weak_ptr &&other) noexcept : block(other.block), p(other.p) {
+        other.block = nullptr;
+        other.p = nullptr;
+    }
+
+    weak_ptr &operator=(weak_ptr other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~weak_ptr() { reset(); }
+
+    void reset() noexcept {
+        if(block)
+            heap::release_weak(block);
+        block = nullptr;
+        p = nullptr;
+    }
+
+    void swap(weak_ptr &other) noexcept {
+        std::swap(block, other.block);
+        std::swap(p, other.p);
+    }
+
+    bool expired() const noexcept { return !block || !block->target; }
+
+    ptr<T> lock() const noexcept {
+        if(expired())
+            return nullptr;
+
+        // it may be unreachable garbage the current cycle hasn't swept yet; it isn't anymore
+        if(block->owner->is_marking)
+            block->owner->shade(block->target);
+        return ptr<T>(block->target, p);
+    }
+
+    bool operator==(const weak_ptr &other) const noexcept { return block == other.block; }
+    bool operator!=(const weak_ptr &other) const noexcept { return block != other.block; }
+
+private:
+    friend struct std::hash<weak_ptr>;
+
+    detail::weak_block *block;
+    T *p;
+};
+
+
+
 template<typename T>
 class anchor_ptr : public ptr<T>, public detail::anchor_node {
 public:
@@ -290,7 +535,9 @@ public:
     void swap(anchor_ptr &other) noexcept { ptr<T>::swap(other); }
 
 
-    detail::node *detail_get_node() const noexcept override { return ptr<T>::n; } 
+    detail::node *detail_get_node() const noexcept override { return detail::untag(ptr<T>::n); } 
+
+    void detail_transverse(action &act) override { act(static_cast<ptr<T>&>(*this)); }
     
 private:
     anchor_ptr(detail::node *n, T *p) noexcept : ptr<T>(n, p), detail::anchor_node() {}
@@ -382,6 +629,60 @@ private:
 
 
 
+// a cheaper anchor for temporaries. instead of linking itself into the heap's anchor list, it takes
+// the next slot of the heap's root stack, which collections scan directly. meant to live on the
+// C++ stack, so that roots are destroyed in roughly the reverse order they were created in
+template<typename T>
+class root {
+public:
+    root() : value() { push(); }
+    root(T val) : value(std::move(val)) { push(); }
+
+    template<typename... Args>
+    root(std::in_place_t, Args&&... args) : value(std::forward<Args>(args)...) { push(); }
+
+    root(const root &other) : value(other.value) { push(); }
+    root(root &&other) : value(std::move(other.value)) { push(); }
+
+    ~root() { detail::current_heap->pop_root(&value); }
+
+    root &operator=(T val) {
+        value = std::move(val);
+        return *this;
+    }
+
+    root &operator=(const root &other) {
+        value = other.value;
+        return *this;
+    }
+
+    root &operator=(root &&other) {
+        value = std::move(other.value);
+        return *this;
+    }
+
+    const T &get() const noexcept { return value; }
+
+    const T *operator->() const noexcept { return &value; }
+    const T &operator*() const noexcept { return value; } 
+
+    T &get() noexcept { return value; }
+
+    T *operator->() noexcept { return &value; }
+    T &operator*() noexcept { return value; } 
+
+private:
+    static void transverse_root(void *value, action &act) {
+        detail::apply_to_all<transverse>()(*static_cast<T*>(value), act);
+    }
+
+    void push() { detail::current_heap->push_root(&value, &transverse_root); }
+
+    T value;
+};
+
+
+
 template<typename T>
 struct allocator {
     using value_type = T;
@@ -399,8 +700,13 @@ struct allocator {
     T *allocate(std::size_t n) { return detail::allocate<T>(n, true); }
 
     void deallocate(T *p, std::size_t n) {
-        std::allocator<T>().deallocate(p, n);
-        detail::memory_used -= sizeof(T) * n + 8;
+        if(detail::is_block_allocation<T>(n))
+            detail::deallocate_block(p, sizeof(T) * n);
+        else if(sizeof(T) * n >= detail::large_allocation_size)
+            detail::large_deallocate(p, sizeof(T) * n);
+        else
+            std::allocator<T>().deallocate(p, n);
+        detail::current_heap->memory_used -= detail::malloc_allocation_size(sizeof(T) * n);
     }
 };
 
@@ -507,6 +813,35 @@ anchor<T> make_anchor(Args&&... args) {
 
 
 
+namespace detail {
+
+
+struct profile_roots_action : action {
+    bool detail_perform(detail::node *node) override {
+        nodes.back() = node;
+        return true;
+    }
+
+    std::vector<detail::node*> nodes;
+};
+
+
+}  // namespace detail
+
+
+// profiles the current heap, taking the objects pointed to by a range of ptrs as the roots
+template<typename Range>
+heap_profile profile(Range &roots) {
+    detail::profile_roots_action act;
+    for(auto &p : roots) {
+        act.nodes.push_back(nullptr);
+        act(p);
+    }
+    return detail::current_heap->profile(act.nodes);
+}
+
+
+
 template<typename T, typename U>
 ptr<T> static_pointer_cast(ptr<U> p) noexcept { return ptr<T>(p.n, static_cast<T*>(p.p)); }
 
@@ -555,6 +890,9 @@ namespace std {
     template<typename T>
     void swap(gc::anchor<T> &left, gc::anchor<T> &right) noexcept { left.swap(right); }
 
+    template<typename T>
+    void swap(gc::weak_ptr<T> &left, gc::weak_ptr<T> &right) noexcept { left.swap(right); }
+
     template<typename T>
     struct hash<gc::ptr<T>> {
         std::size_t operator()(const gc::ptr<T> &p) const { return std::hash<T*>()(p.get()); }
@@ -570,6 +908,13 @@ namespace std {
         std::size_t operator()(const gc::anchor<T> &n) const { return std::hash<T>()(n.get()); }
     };
 
+    template<typename T>
+    struct hash<gc::weak_ptr<T>> {
+        std::size_t operator()(const gc::weak_ptr<T> &p) const noexcept { 
+            return std::hash<gc::detail::weak_block*>()(p.block); 
+        }
+    };
+
 }  // namespace std
 
 #endif
@@ -2,16 +2,24 @@
 #define LIPH_GC_DETAIL_HPP
 
 #include "debug.hpp"
+#include "gc_marker.hpp"
+#include "gc_pool.hpp"
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #ifdef DEBUG
 #include <string>
@@ -26,12 +34,10 @@
 #endif
 
 
-// TODO: make collect() and iterate_from not use global temp_head
 // TODO: const correctness?
 // TODO: use allocators?
 // TODO: exception safe
 // TODO: support T[]
-// TODO: weak_ptr
 // TODO: on gc::ptr constructor, call transverse and check
 //       that all gc::ptrs that have been created are
 //       reached via transverse.
@@ -44,12 +50,17 @@ extern bool run_on_bad_alloc;
 void collect();
 
 
+class heap;
+
 template<typename T>
 struct ptr;
 
 template<typename T>
 struct anchor_ptr;
 
+template<typename T>
+struct allocator;
+
 struct action;
 
 
@@ -60,6 +71,12 @@ public:
 };
 
 
+class allocation_budget_exceeded : public std::bad_alloc {
+public:
+    const char* what() const noexcept override { return "allocation budget exceeded"; }
+};
+
+
 
 namespace detail {
 
@@ -100,6 +117,13 @@ template<typename T>
 constexpr bool has_before_destroy_v<T, std::void_t<decltype(std::declval<T>().before_destroy())>> = true;
 
 
+template<typename T, typename = std::void_t<>>
+constexpr bool has_storage_size_v = false;
+
+template<typename T>
+constexpr bool has_storage_size_v<T, std::void_t<decltype(std::declval<const T&>().storage_size())>> = true;
+
+
 
 template<typename T>
 struct do_action;
@@ -153,6 +177,11 @@ struct transverse<ptr<T>> {
     void operator()(ptr<T> &p, action &act) { act(p); }
 };
 
+template<typename T>
+struct transverse<const ptr<T>> {
+    void operator()(const ptr<T> &p, action &act) { act(p); }
+};
+
 
 template<typename T>
 struct transverse<anchor_ptr<T>> {
@@ -168,6 +197,9 @@ struct action {
     }
 
     virtual bool detail_perform(detail::node *node) = 0;
+
+    // called instead of detail_perform for a ptr made by gc::defer
+    virtual bool detail_perform_deferred(detail::node *node) { return detail_perform(node); }
 };
 
 
@@ -176,6 +208,7 @@ namespace detail {
 
 
 struct node;
+struct node_list;
 struct anchor_node;
 
 struct sentinel {};
@@ -184,32 +217,154 @@ template<typename T>
 struct object;
 
 
-extern node active_head;
-extern node temp_head;
-extern anchor_node anchor_head;
-extern bool is_running;
-extern bool is_retrying;
-extern std::size_t nested_create_count;
-extern std::size_t memory_used;
-extern std::size_t memory_limit;
+extern heap default_heap;
+
+// the heap every object, anchor and allocation of this thread goes to
+inline thread_local heap *current_heap = &default_heap;
 
 
-void debug_not_head(node *n, node *allowed_head);
-void transverse_list(node &head, node *old_head, action &act);
+void transverse_list(node_list &list, node *old_first, action &act);
 void transverse_and_mark_reachable(anchor_node &n, action &act);
 void transverse_and_mark_reachable(node *ptr, action &act);
-void transverse_and_mark_reachable(anchor_node &n);
-void transverse_and_mark_reachable(node *ptr);
-void free_delayed();
-void free_unreachable();
-void reset_reachable_flag(node &head);
-void delete_list(node &head, bool dec_counts);
-void move_temp_to_active();
+
+
+// a ptr made by gc::defer doesn't add to its node's ref_count. it's told apart by the low bit of its node pointer
+constexpr std::uintptr_t deferred_tag = 1;
+
+inline bool is_deferred(const node *n) noexcept { return reinterpret_cast<std::uintptr_t>(n) & deferred_tag; }
+
+inline node *untag(node *n) noexcept {
+    return reinterpret_cast<node*>(reinterpret_cast<std::uintptr_t>(n) & ~deferred_tag);
+}
 
 
 template<typename T>
-std::size_t get_memory_used_for() {
-    return sizeof(object<T>) + 8;
+constexpr std::size_t get_memory_used_for() {
+    return pool_allocation_size(sizeof(object<T>));
+}
+
+
+// gc::allocator blocks at least this big get pages of their own, which go back to the os as soon as
+// they're freed. left to malloc, they would stay in its heap once glibc has raised its own mmap
+// threshold, which it does every time such a block is freed
+constexpr std::size_t large_allocation_size = 128 * 1024;
+
+void *large_allocate(std::size_t size);
+void large_deallocate(void *p, std::size_t size) noexcept;
+
+
+// the bytes a gc::allocator block of the given size really takes: a whole bin up to max_block_size,
+// whole pages from large_allocation_size, and malloc's in between, in glibc's layout (others are
+// close): a size word in front, rounded up to 16 bytes and at least 32
+constexpr std::size_t malloc_allocation_size(std::size_t size) {
+    if(size >= large_allocation_size)
+        return (size + 4095) / 4096 * 4096;
+    if(size <= max_block_size)
+        return block_bin_size(block_bin_index(size));
+
+    std::size_t chunk = (size + 8 + 15) / 16 * 16;
+    return chunk < 32 ? 32 : chunk;
+}
+
+
+}  // namespace detail
+
+
+
+// the bytes of gc::allocator storage a value owns beyond its own sizeof, which is what a heap profile
+// adds to the size of each object. gc objects it points to aren't included. a type can report its own
+// with a storage_size() member; the standard containers on gc::allocator are covered below
+template<typename T>
+struct storage_size {
+    std::size_t operator()(const T &value) const {
+        if constexpr(detail::has_storage_size_v<T>)
+            return value.storage_size();
+        else
+            return 0;
+    }
+};
+
+
+template<typename T>
+struct storage_size<std::vector<T, allocator<T>>> {
+    std::size_t operator()(const std::vector<T, allocator<T>> &v) const {
+        std::size_t size = v.capacity() ? detail::malloc_allocation_size(v.capacity() * sizeof(T)) : 0;
+        for(const T &item : v)
+            size += storage_size<T>()(item);
+        return size;
+    }
+};
+
+
+template<typename CharT, typename Traits>
+struct storage_size<std::basic_string<CharT, Traits, allocator<CharT>>> {
+    std::size_t operator()(const std::basic_string<CharT, Traits, allocator<CharT>> &str) const {
+        // a short string is kept inside the object
+        const char *data = reinterpret_cast<const char*>(str.data());
+        const char *self = reinterpret_cast<const char*>(&str);
+        if(data >= self && data < self + sizeof(str))
+            return 0;
+        return detail::malloc_allocation_size((str.capacity() + 1) * sizeof(CharT));
+    }
+};
+
+
+template<typename Key, typename T, typename Hash, typename Equal>
+struct storage_size<std::unordered_map<Key, T, Hash, Equal, allocator<std::pair<const Key, T>>>> {
+    std::size_t operator()(const std::unordered_map<Key, T, Hash, Equal, allocator<std::pair<const Key, T>>> &map) const {
+        // each element sits in a node along with the next pointer and its hash
+        std::size_t node_size = detail::malloc_allocation_size(2 * sizeof(void*) + sizeof(std::pair<const Key, T>));
+        std::size_t size = map.size() * node_size;
+        if(map.bucket_count() > 1)  // a single bucket is kept inside the map
+            size += detail::malloc_allocation_size(map.bucket_count() * sizeof(void*));
+
+        for(const auto &item : map)
+            size += storage_size<Key>()(item.first) + storage_size<T>()(item.second);
+        return size;
+    }
+};
+
+
+// a shared_ptr's control block and the value made along with it, as std::allocate_shared does.
+// a value shared by several of them is counted for each
+template<typename T>
+struct storage_size<std::shared_ptr<T>> {
+    std::size_t operator()(const std::shared_ptr<T> &p) const {
+        if(!p)
+            return 0;
+        return detail::malloc_allocation_size(sizeof(void*) + 2 * sizeof(int) + sizeof(T)) + storage_size<T>()(*p);
+    }
+};
+
+
+template<typename... Ts>
+struct storage_size<std::variant<Ts...>> {
+    std::size_t operator()(const std::variant<Ts...> &v) const {
+        return std::visit([](const auto &value) { 
+            return storage_size<std::decay_t<decltype(value)>>()(value); 
+        }, v);
+    }
+};
+
+
+template<typename T, typename U>
+struct storage_size<std::pair<T, U>> {
+    std::size_t operator()(const std::pair<T, U> &p) const {
+        return storage_size<T>()(p.first) + storage_size<U>()(p.second);
+    }
+};
+
+
+
+namespace detail {
+
+
+// acts on the node of a ptr that isn't null
+inline void perform(node *n, action &act) {
+    if(is_deferred(n))
+        act.detail_perform_deferred(untag(n));
+    else
+        act.detail_perform(n);
 }
 
 
@@ -218,7 +373,14 @@ struct do_action {
     template<typename U>
     void operator()(ptr<U> &p, action &act) {
         if(p.p)
-            act.detail_perform(p.n);
+            perform(p.n, act);
+    }
+
+    // for the keys of a map
+    template<typename U>
+    void operator()(const ptr<U> &p, action &act) {
+        if(p.p)
+            perform(p.n, act);
     }
 };
 
@@ -252,6 +414,29 @@ constexpr bool can_apply_to_all(int, std::void_t<decltype(apply_to_all<Func>()(s
 
 
 
+// whether a T can hold a ptr, so transversing it can reach a node
+template<typename T, typename = void>
+struct is_transversable : std::bool_constant<can_apply<T, gc::transverse, action>(0)> {};
+
+template<typename T>
+struct is_transversable<T, std::enable_if_t<is_container_v<T> && !can_apply<T, gc::transverse, action>(0)>> 
+    : is_transversable<std::remove_cv_t<std::remove_reference_t<decltype(*begin(std::declval<T&>()))>>> {};
+
+template<typename... Ts>
+struct is_transversable<std::variant<Ts...>> : std::disjunction<is_transversable<std::remove_cv_t<Ts>>...> {};
+
+template<typename... Ts>
+struct is_transversable<std::tuple<Ts...>> : std::disjunction<is_transversable<std::remove_cv_t<Ts>>...> {};
+
+template<typename T, typename U>
+struct is_transversable<std::pair<T, U>> 
+    : std::disjunction<is_transversable<std::remove_cv_t<T>>, is_transversable<std::remove_cv_t<U>>> {};
+
+template<typename T>
+constexpr bool is_transversable_v = is_transversable<std::remove_cv_t<T>>::value;
+
+
+
 template<template<typename> typename Func>
 struct apply_to_all {
     template<typename T, typename... Args>
@@ -338,28 +523,97 @@ struct list_node {
 };
 
 
-struct node : list_node<node> {
-    node() noexcept : list_node(this, this) {}
-    virtual ~node() {}
+// what the collector needs to know about the type of a node. nodes carry a 16-bit index into
+// a table of these instead of a vtable pointer. the flags let the collector skip the calls that
+// would do nothing: a node that can't hold a ptr is marked without being pushed to be transversed
+struct node_type {
+    void (*transverse)(node *n, action &act);
+    void (*before_destroy)(node *n);
+    void (*destroy)(node *n);
+    void *(*get_value)(node *n);
+    std::size_t (*storage_size)(node *n);
+    std::size_t memory_used;
+    bool has_children;
+    bool trivial_destroy;
+};
 
-    virtual void transverse(action &) {}
-    virtual void before_destroy() {}
-    virtual void *get_value() { return nullptr; }
 
-    virtual std::size_t get_memory_used() { return 0; }
-    
+constexpr std::size_t max_node_types = 1024;
 
-    void list_remove() {
-        if(debug)
-            debug_not_head(this, nullptr);
-        list_node<node>::list_remove();
+extern const node_type *node_types[max_node_types];
+
+std::uint32_t register_node_type(const node_type *type);
+
+template<typename T>
+std::uint32_t node_type_index();
+
+
+// the cycle collector's trial deletion colors. every node is black outside of collect_cycles
+enum class node_color : std::uint8_t { black, gray, white };
+
+
+// the whole header of a gc object. the pool's live bitmap says which slots hold nodes, and link
+// is only used by the zero count table and while the collector frees a node. has_weak says the
+// heap has a weak_block for it
+struct node {
+    explicit node(std::uint32_t type) noexcept : type(static_cast<std::uint16_t>(type)) {}
+
+    void transverse(action &act) { 
+        const node_type *t = node_types[type];
+        if(t->has_children)
+            t->transverse(this, act); 
     }
 
-    bool mark_reachable();
+    void before_destroy() { node_types[type]->before_destroy(this); }
+
+    void destroy() { 
+        const node_type *t = node_types[type];
+        if(!t->trivial_destroy)
+            t->destroy(this); 
+    }
+
+    void *get_value() { return node_types[type]->get_value(this); }
+
+    std::size_t get_memory_used() const { return node_types[type]->memory_used; }
+    bool has_children() const { return node_types[type]->has_children; }
+
+    // what it takes up together with the storage its value owns
+    std::size_t get_size() { return node_types[type]->memory_used + node_types[type]->storage_size(this); }
+
     void free();
 
-    std::size_t ref_count = 1;
-    bool reachable = false;
+    node *link = nullptr;
+    std::uint32_t ref_count = 1;
+    std::uint16_t type;
+    node_color color = node_color::black;
+    bool has_weak = false;
+};
+
+
+// ends a heap's zero count table. a live node is in the table exactly when its link isn't null
+extern node zct_end;
+
+
+// a singly-linked list threaded through node::link
+struct node_list {
+    void push(node *n) noexcept {
+        n->link = first;
+        first = n;
+    }
+
+    bool empty() const noexcept { return !first; }
+
+    node *first = nullptr;
+};
+
+
+
+// what the weak_ptrs to a node share, so the node itself needs no more than a flag. target is
+// cleared once the node is doomed, and the block goes once the last weak_ptr does
+struct weak_block {
+    node *target;
+    heap *owner;
+    std::size_t weak_count;
 };
 
 
@@ -367,23 +621,43 @@ struct node : list_node<node> {
 template<typename T>
 struct object : node {
     template<typename... Args>
-    object(Args&&... args) : node(), value(std::forward<Args>(args)...) {}
+    object(Args&&... args) : node(node_type_index<T>()), value(std::forward<Args>(args)...) {}
 
-    void transverse(action &act) override { apply_to_all<gc::transverse>()(value, act); }
-    void before_destroy() override { apply_to_all<gc::before_destroy>()(value); }
-    void *get_value() override { return &value; }
+    static void transverse_node(node *n, action &act) { 
+        if constexpr(is_transversable_v<T>)
+            apply_to_all<gc::transverse>()(static_cast<object*>(n)->value, act); 
+    }
+
+    static void before_destroy_node(node *n) { apply_to_all<gc::before_destroy>()(static_cast<object*>(n)->value); }
+    static void destroy_node(node *n) { static_cast<object*>(n)->~object(); }
+    static void *get_value_node(node *n) { return &static_cast<object*>(n)->value; }
+    static std::size_t storage_size_node(node *n) { return gc::storage_size<T>()(static_cast<object*>(n)->value); }
 
-    std::size_t get_memory_used() override { return get_memory_used_for<T>(); }
+    static const node_type type_info;
 
     T value;
 };
 
 
+template<typename T>
+const node_type object<T>::type_info = {
+    &transverse_node, &before_destroy_node, &destroy_node, &get_value_node, &storage_size_node, get_memory_used_for<T>(),
+    is_transversable_v<T>, std::is_trivially_destructible_v<T>
+};
+
+
+template<typename T>
+std::uint32_t node_type_index() {
+    static const std::uint32_t index = register_node_type(&object<T>::type_info);
+    return index;
+}
+
+
 struct anchor_node : list_node<anchor_node> {
-    anchor_node() noexcept { list_insert(anchor_head); }
+    anchor_node() noexcept;
     anchor_node(sentinel) noexcept : list_node(this, this) {}
 
-    ~anchor_node() { list_remove(); }
+    ~anchor_node();
 
     virtual void detail_transverse(action &) {}
     //virtual void detail_transverse(action &) const {}
@@ -392,12 +666,273 @@ struct anchor_node : list_node<anchor_node> {
 };
 
 
+// an entry of a heap's root stack: the address of a gc::root's value and how to transverse it
+struct root_slot {
+    void *value;
+    void (*transverse)(void *value, action &act);
+};
+
+
+}  // namespace detail
+
+
+
+// what a heap profile found under one root: the root object itself, and everything reachable from it
+// but from none of the other roots. objects that several roots lead to are only counted in the shared totals
+struct retained_size {
+    std::size_t shallow_bytes = 0;
+    std::size_t retained_objects = 0;
+    std::size_t retained_bytes = 0;
+};
+
+
+struct heap_profile {
+    std::vector<retained_size> roots;   // in the order the roots were given
+    std::size_t shared_objects = 0;
+    std::size_t shared_bytes = 0;
+};
+
+
+
+// what a heap has done so far. everything in it is kept up to date as the heap runs,
+// so reading it is O(1)
+struct stats {
+    std::size_t collections = 0;            // marking cycles run to completion, full or incremental
+    std::size_t incremental_slices = 0;
+    std::chrono::nanoseconds total_pause{0};  // time spent in collect() and in incremental slices
+    std::chrono::nanoseconds max_pause{0};
+    std::chrono::nanoseconds last_pause{0};
+
+    std::size_t last_objects_freed = 0;     // by the sweep of the most recent collection
+    std::size_t last_bytes_freed = 0;
+    std::size_t total_objects_freed = 0;
+    std::size_t total_bytes_freed = 0;
+
+    std::size_t limit_retries = 0;          // collections forced by an allocation reaching the memory limit
+    std::size_t bad_alloc_retries = 0;      // collections forced by an allocation throwing std::bad_alloc
+    std::size_t paced_collections = 0;      // collections started by the heap outgrowing the pacing trigger
+
+    std::size_t cycle_collections = 0;      // trial deletions run over the cycle candidates
+    std::size_t cycle_objects_freed = 0;
+
+    std::size_t lazy_objects_freed = 0;     // destroyed a slice at a time from the free queue
+
+    // changes to ref_counts made by copying and dropping ptrs and objects. only counted in a build
+    // with GC_COUNT_REFS defined, since it costs a little on every one
+    std::size_t ref_increments = 0;
+    std::size_t ref_decrements = 0;
+
+    std::size_t bytes_allocated = 0;        // by every object and allocation so far, freed or not
+    std::size_t live_objects = 0;           // allocated and not freed yet, so garbage awaiting a collection too
+    std::size_t memory_used = 0;
+    std::size_t memory_limit = 0;
+};
+
+
+
+// owns every object, anchor and gc::allocator allocation made while it is a thread's current heap.
+// an object may only be used by a thread whose current heap is the heap it was created in, so
+// separate heaps can be used from separate threads without any locking
+class heap {
+public:
+    heap() noexcept : anchor_head(detail::sentinel()) {}
+    ~heap();
+
+    heap(const heap &) = delete;
+    heap &operator=(const heap &) = delete;
+
+    void collect();
+
+    std::size_t object_count();
+    std::size_t anchor_count();
+    stats get_stats() const;
+
+    std::size_t get_memory_used() const { return memory_used; }
+    std::size_t get_memory_limit() const { return memory_limit; }
+    void set_memory_limit(std::size_t limit);
+
+    // caps the bytes allocated from now on, however much of them is freed again. the allocation that
+    // would go past it throws allocation_budget_exceeded, until the budget is set again or cleared
+    void set_allocation_budget(std::size_t bytes);
+    void clear_allocation_budget();
+    std::size_t get_bytes_allocated() const { return bytes_allocated; }
+
+    void set_incremental(bool enabled);
+    bool is_incremental() const { return incremental_enabled; }
+    void set_incremental_start(std::size_t percent_of_limit);
+    void set_slice_budget(std::size_t max_nodes, std::chrono::microseconds max_time);
+    void step();
+
+    void set_parallel_mark(std::size_t threads, std::size_t min_nodes);
+
+    // with pacing on, an allocation starts a collection (an incremental cycle if that's on) once memory used
+    // has grown by growth_percent over what the last collection left alive. the point at which that happens
+    // is kept between min_bytes and max_bytes, where a max_bytes of 0 means the memory limit
+    void set_pacing(bool enabled, std::size_t growth_percent, std::size_t min_bytes, std::size_t max_bytes);
+
+    // with cycle collection on, every node whose count is decremented to something other than 0 becomes
+    // a candidate, and once there are max_candidates of them (or an allocation would exceed the memory
+    // limit) the garbage cycles through them are found by trial deletion instead of a full collect()
+    void set_cycle_collection(bool enabled, std::size_t max_candidates);
+    void collect_cycles();
+
+    // whether gc::defer makes uncounted ptrs, and how many nodes may wait in the zero count table
+    // before an allocation reconciles it
+    void set_deferred_rc(bool enabled, std::size_t max_pending);
+
+    // with lazy freeing on, objects whose count drops to 0 are queued and destroyed at most slice_nodes
+    // at a time: a slice when they're queued and one on each allocation. free_slice() destroys another
+    // one (returning true once the queue is empty), and the queue is emptied before a collection or
+    // when an allocation would exceed the memory limit
+    void set_lazy_free(bool enabled, std::size_t slice_nodes);
+    bool free_slice(std::size_t max_nodes);
+
+    // the sizes retained by each of the given nodes (null ones retain nothing). an object's size is
+    // its node plus the gc::allocator storage its value owns (see gc::storage_size)
+    heap_profile profile(const std::vector<detail::node*> &roots);
+
+    // the rest is the collector's state, used by ptr, anchor and allocator
+
+    void free_delayed(detail::node_list &list);
+    void destroy_queued(std::size_t max_nodes);
+    void free_unmarked();
+    void delete_list(detail::node_list &list, bool dec_counts);
+
+    void shade(detail::node *n) noexcept;
+    bool mark_slice(std::size_t max_nodes, std::chrono::steady_clock::duration max_time);
+    void shade_nested();
+    void shade_roots();
+    void zct_push(detail::node *n) noexcept;
+    void release_zct();
+    void reconcile();
+    void count_deferred(bool increment);
+    bool is_deferring() const noexcept { return deferred_refs && !is_reconciling; }
+    void rescan_marked();
+    void release_zombies();
+    void incremental_step();
+    void finish_marking();
+    void cancel_marking();
+    void parallel_mark();
+    void record_pause(std::chrono::steady_clock::time_point start);
+    void update_pacing();
+    void paced_collect();
+    void reclaim(std::size_t size);
+    void add_candidate(detail::node *n) { if(cycle_collection) pool.add_candidate(n); }
+
+    detail::weak_block *acquire_weak(detail::node *n);
+    static void release_weak(detail::weak_block *block) noexcept;
+    void clear_weak(detail::node *n) noexcept;
+
+    detail::pool pool;
+    detail::anchor_node anchor_head;
+
+    // the slots of every live gc::root, oldest first. a root that isn't on top when it's destroyed
+    // only clears its slot, which is dropped once everything above it is gone
+    std::unique_ptr<detail::root_slot[]> root_stack;
+    detail::root_slot *root_top = nullptr;
+    detail::root_slot *root_end = nullptr;
+
+    void push_root(void *value, void (*transverse)(void *, action &)) {
+        if(root_top == root_end)
+            grow_roots();
+        root_top->value = value;
+        root_top->transverse = transverse;
+        ++root_top;
+    }
+
+    void pop_root(void *value) noexcept {
+        if(root_top[-1].value != value) {
+            clear_root(value);
+            return;
+        }
+
+        do
+            --root_top;
+        while(root_top != root_stack.get() && !root_top[-1].value);
+    }
+
+    void grow_roots();
+    void clear_root(void *value) noexcept;
+
+    // nodes created while another object was still being constructed aren't reachable from any anchor yet
+    std::vector<detail::node*> nested_nodes;
+
+    bool is_running = false;
+    bool is_retrying = false;
+    std::size_t nested_create_count = 0;
+    std::size_t node_count = 0;
+    std::size_t memory_used = 0;
+    std::size_t memory_limit = std::numeric_limits<std::size_t>::max();
+    std::size_t bytes_allocated = 0;
+    std::size_t budget_end = std::numeric_limits<std::size_t>::max();
+
+    bool is_marking = false;
+    bool incremental_enabled = false;
+    std::size_t incremental_start_percent = 75;
+    std::size_t incremental_trigger = std::numeric_limits<std::size_t>::max();
+    detail::anchor_node *root_cursor = nullptr;
+
+    // nodes whose ref_count dropped to 0 after being marked; their destruction waits for the end of the cycle
+    detail::node_list zombies;
+    std::vector<detail::node*> gray_stack;
+    bool gray_overflow = false;
+    std::size_t slice_nodes = 1000;
+    std::chrono::microseconds slice_time{1000};
+
+    // deferred reference counting. while any ptr made by gc::defer is alive, a node whose count drops
+    // to 0 waits in the zero count table (zct) until reconcile() has counted the deferred ptrs in
+    // every anchor and root; the ones still at 0 then are garbage
+    bool deferred_rc = false;
+    bool is_reconciling = false;
+    std::size_t deferred_refs = 0;
+    detail::node *zct = &detail::zct_end;
+    std::size_t zct_size = 0;
+    std::size_t zct_limit = 10000;
+
+    bool cycle_collection = false;
+    std::size_t cycle_candidate_limit = 10000;
+
+    // nodes at 0 that haven't been transversed or destroyed yet, linked through node::link
+    bool lazy_free = false;
+    std::size_t lazy_free_slice = 1000;
+    detail::node_list free_queue;
+
+    bool pacing = false;
+    std::size_t pacing_growth_percent = 100;
+    std::size_t pacing_min = 4000000;
+    std::size_t pacing_max = 0;
+    std::size_t pacing_trigger = std::numeric_limits<std::size_t>::max();
+
+    std::unordered_map<detail::node*, detail::weak_block*> weak_blocks;
+
+    std::size_t mark_threads = 1;
+    std::size_t parallel_mark_min_nodes = 100000;
+    std::unique_ptr<detail::parallel_marker> marker;
+
+    stats counters;
+};
+
+
+
+namespace detail {
+
+
+inline anchor_node::anchor_node() noexcept { list_insert(current_heap->anchor_head); }
+
+
+inline anchor_node::~anchor_node() {
+    if(current_heap->root_cursor == this)
+        current_heap->root_cursor = next;
+    list_remove(); 
+}
+
+
 
 template<typename T>
 struct creation_tracker {
-    creation_tracker() : has_reset(false) { 
-        ++nested_create_count;
-        memory_used += get_memory_used_for<T>(); 
+    creation_tracker() : h(*current_heap), has_reset(false) { 
+        ++h.nested_create_count;
+        h.memory_used += get_memory_used_for<T>(); 
     }
     
     ~creation_tracker() { reset(); }
@@ -406,11 +941,14 @@ struct creation_tracker {
         if(has_reset)
             return;
         has_reset = true;
-        memory_used -= get_memory_used_for<T>();
-        if(--nested_create_count == 0)
-            is_retrying = false;
+        h.memory_used -= get_memory_used_for<T>();
+        if(--h.nested_create_count == 0) {
+            h.is_retrying = false;
+            h.nested_nodes.clear();
+        }
     }
 
+    heap &h;
     bool has_reset;
 };
 
@@ -418,78 +956,146 @@ struct creation_tracker {
 
 template<typename T, typename... Args>
 object<T> *create_object(Args&&... args) {
-    std::size_t new_memory_used = memory_used + get_memory_used_for<T>();
+    heap &h = *current_heap;
+    if(h.is_marking)
+        h.incremental_step();
+    else if(h.memory_used >= h.pacing_trigger)
+        h.paced_collect();
+    if(h.zct_size >= h.zct_limit)
+        h.reconcile();
+    if(h.pool.candidate_count >= h.cycle_candidate_limit)
+        h.collect_cycles();
+    if(!h.free_queue.empty())
+        h.free_slice(h.lazy_free_slice);
+
+    std::size_t new_memory_used = h.memory_used + get_memory_used_for<T>();
     
-    if(new_memory_used > memory_limit) {
+    if(new_memory_used > h.memory_limit) {
         debug_out(std::to_string(new_memory_used) + " will exceed memory limit "
-                + std::to_string(memory_limit));
+                + std::to_string(h.memory_limit));
 
-        if(run_on_bad_alloc && !is_retrying) {
+        if(run_on_bad_alloc && !h.is_retrying) {
             debug_out("retrying on exceeding memory usage");
-            is_retrying = true;
-            collect();
+            h.is_retrying = true;
+            ++h.counters.limit_retries;
+            h.reclaim(get_memory_used_for<T>());
             return create_object<T>(std::forward<Args>(args)...);
         } else {
-            is_retrying = false;
+            h.is_retrying = false;
             throw memory_limit_exceeded();
         }
     }
 
+    // charged up front, so objects the constructor creates count against what's left. a throw
+    // takes the charge back, as nothing was allocated
+    if(h.budget_end - h.bytes_allocated < get_memory_used_for<T>())
+        throw allocation_budget_exceeded();
+    h.bytes_allocated += get_memory_used_for<T>();
+
+    static_assert(alignof(object<T>) <= pool_granularity, "gc node is over-aligned for the node pool");
+
     creation_tracker<T> tracker;
     try {
-        auto node = new detail::object<T>(std::forward<Args>(args)...);
-
-        if(run_on_bad_alloc && !is_retrying) {
-            node->list_insert(nested_create_count > 1 ? temp_head : active_head);
-        } else {
-            debug_out("inserting directly to active");
-            node->list_insert(active_head);
+        bool nested = run_on_bad_alloc && !h.is_retrying && h.nested_create_count > 1;
+        if(nested)
+            h.nested_nodes.reserve(h.nested_nodes.size() + 1);
+
+        void *slot = h.pool.allocate(sizeof(object<T>));
+        object<T> *node;
+        try {
+            node = new (slot) detail::object<T>(std::forward<Args>(args)...);
+        } catch(...) {
+            h.pool.deallocate(slot);
+            throw;
         }
-        
-        if(nested_create_count == 1)
-            move_temp_to_active();
 
-        memory_used += get_memory_used_for<T>();
+        // objects created while marking is in progress are never garbage for the current cycle
+        pool_set_live(node);
+        if(h.is_marking)
+            pool_mark(node);
+
+        if(nested)
+            h.nested_nodes.push_back(node);
+
+        h.memory_used += get_memory_used_for<T>();
+        ++h.node_count;
         return node;
+    } catch(allocation_budget_exceeded &) {
+        // a nested object went over the budget, which no collection can help with
+        h.bytes_allocated -= get_memory_used_for<T>();
+        throw;
     } catch(std::bad_alloc &) {
+        h.bytes_allocated -= get_memory_used_for<T>();
 
-        if(run_on_bad_alloc && !is_retrying) {
+        if(run_on_bad_alloc && !h.is_retrying) {
             debug_out("retrying on bad alloc");
             tracker.reset();
-            is_retrying = true;
-            collect();
+            h.is_retrying = true;
+            ++h.counters.bad_alloc_retries;
+            h.collect();
             return create_object<T>(std::forward<Args>(args)...);
         } else {
             throw;
         }
+    } catch(...) {
+        h.bytes_allocated -= get_memory_used_for<T>();
+        throw;
     }
 }
 
 
+template<typename T>
+constexpr bool is_block_allocation(std::size_t n) {
+    return alignof(T) <= min_block_size && sizeof(T) * n <= max_block_size;
+}
+
+
 template<typename T>
 T *allocate(std::size_t n, bool retry) {
-    std::size_t new_memory_used = memory_used + sizeof(T) * n + 8;
+    if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+
+    heap &h = *current_heap;
+    if(h.is_marking && retry)
+        h.incremental_step();
+    else if(h.memory_used >= h.pacing_trigger && retry)
+        h.paced_collect();
+
+    std::size_t size = malloc_allocation_size(sizeof(T) * n);
+    std::size_t new_memory_used = h.memory_used + size;
     
-    if(new_memory_used > memory_limit) {
+    if(new_memory_used > h.memory_limit) {
         debug_out("allocator: " + std::to_string(new_memory_used) 
-                + " will exceed memory limit " + std::to_string(memory_limit));
+                + " will exceed memory limit " + std::to_string(h.memory_limit));
         if(run_on_bad_alloc && retry) {
             debug_out("allocator: retrying");
-            collect();
+            ++h.counters.limit_retries;
+            h.reclaim(size);
             return allocate<T>(n, false);
         } else {
             throw memory_limit_exceeded();
         }
     }
 
+    if(h.budget_end - h.bytes_allocated < size)
+        throw allocation_budget_exceeded();
+
     try {
-        T *p = std::allocator<T>().allocate(n); 
-        memory_used = new_memory_used;
+        T *p;
+        if(is_block_allocation<T>(n))
+            p = static_cast<T*>(allocate_block(sizeof(T) * n));
+        else if(sizeof(T) * n >= large_allocation_size)
+            p = static_cast<T*>(large_allocate(sizeof(T) * n));
+        else
+            p = std::allocator<T>().allocate(n); 
+        h.memory_used = new_memory_used;
+        h.bytes_allocated += size;
         return p;
     } catch(std::bad_alloc &) {
         if(run_on_bad_alloc && retry) {
             debug_out("allocator: retrying on bad alloc");
-            collect();
+            ++h.counters.bad_alloc_retries;
+            h.collect();
             return allocate<T>(n, false);
         } else {
             throw;
@@ -0,0 +1,81 @@
+#ifndef LIPH_GC_MARKER_HPP
+#define LIPH_GC_MARKER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace gc {
+
+namespace detail {
+
+
+struct node;
+struct anchor_node;
+
+
+// marks a heap with a small pool of threads. the calling thread takes part as worker 0.
+// anchors are handed out in chunks; each worker traces from a private stack and publishes
+// part of it to a locked deque that idle workers steal from.
+class parallel_marker {
+public:
+    explicit parallel_marker(std::size_t thread_count);
+    ~parallel_marker();
+
+    parallel_marker(const parallel_marker &) = delete;
+    parallel_marker &operator=(const parallel_marker &) = delete;
+
+    std::size_t thread_count() const { return workers.size(); }
+
+    // marks everything reachable from roots and from the (already marked) gray nodes.
+    // returns false if a mark stack failed to grow, in which case some marked nodes were not transversed
+    bool mark(const std::vector<anchor_node*> &roots, std::vector<node*> &gray);
+
+private:
+    struct worker {
+        std::vector<node*> local;
+        std::mutex lock;
+        std::deque<node*> shared;
+        std::atomic<std::size_t> shared_size{0};
+    };
+
+    struct mark_action;
+
+    void stop();
+    void run(std::size_t index);
+    void drain(std::size_t index);
+    bool take_roots(worker &w);
+    bool take_shared(worker &w);
+    bool steal(std::size_t index);
+    void share(worker &w);
+    bool has_work() const;
+
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::thread> threads;
+
+    const std::vector<anchor_node*> *roots = nullptr;
+    std::atomic<std::size_t> next_root{0};
+    std::atomic<std::size_t> idle{0};
+    std::atomic<bool> overflow{false};
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t generation = 0;
+    std::size_t finished = 0;
+    bool stopping = false;
+};
+
+
+}  // namespace detail
+
+}  // namespace gc
+
+#endif
+
@@ -0,0 +1,299 @@
+#ifndef LIPH_GC_POOL_HPP
+#define LIPH_GC_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+namespace gc {
+
+namespace detail {
+
+
+// nodes are carved out of page-aligned slabs. every slab holds slots of a single size class,
+// so the owning page of any node can be found by masking its address.
+constexpr std::size_t pool_page_size = 64 * 1024;
+constexpr std::size_t pool_granularity = 16;
+constexpr std::size_t pool_max_slot_size = 512;
+constexpr std::size_t pool_class_count = pool_max_slot_size / pool_granularity;
+constexpr std::size_t pool_bitmap_words = pool_page_size / pool_granularity / 64;
+
+
+struct pool_page;
+
+
+struct pool_class {
+    pool_page *partial = nullptr;   // pages with at least one free slot
+    pool_page *empty = nullptr;     // pages with no live slots, kept until the next release
+    std::size_t page_count = 0;
+};
+
+
+// a collection never touches the nodes' own memory to mark them. mark bits live in a side bitmap
+// in the page header, next to the bitmap of slots that hold a fully constructed node. a third
+// bitmap holds the cycle collector's candidates, so a freed node drops out of it for free.
+struct pool_page {
+    pool_page *next_page;
+    pool_page *prev_page;
+    pool_page **list;
+    pool_page *next_all;
+    pool_page *prev_all;
+    void *free_list;
+    char *bump;
+    char *slots;
+    std::size_t slot_size;
+    std::size_t used;
+    std::size_t capacity;
+    pool_class *owner;
+    std::uint64_t live_bits[pool_bitmap_words];
+    std::uint64_t mark_bits[pool_bitmap_words];
+    std::uint64_t candidate_bits[pool_bitmap_words];
+};
+
+
+constexpr std::size_t pool_header_size = (sizeof(pool_page) + pool_granularity - 1) / pool_granularity * pool_granularity;
+
+
+constexpr bool is_pooled_size(std::size_t size) { return size <= pool_max_slot_size; }
+
+constexpr std::size_t pool_class_index(std::size_t size) {
+    return (size + pool_granularity - 1) / pool_granularity - 1;
+}
+
+constexpr std::size_t pool_large_size(std::size_t size) {
+    return (pool_header_size + size + pool_page_size - 1) / pool_page_size * pool_page_size;
+}
+
+// the number of bytes a node of the given size actually occupies
+constexpr std::size_t pool_allocation_size(std::size_t size) {
+    return is_pooled_size(size) ? (pool_class_index(size) + 1) * pool_granularity : pool_large_size(size);
+}
+
+
+// the slab pages of a single heap
+struct pool {
+    pool() = default;
+    ~pool();
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    void *allocate(std::size_t size);
+    void deallocate(void *p);
+    void release_empty_pages();
+    void clear_marks();
+
+    std::size_t page_count() const;
+
+    // makes p a possible root of a garbage cycle
+    void add_candidate(const void *p);
+
+    // these call func(slot) for every slot holding a constructed node (that is or isn't marked)
+    template<typename Func>
+    void for_each_live(Func &&func);
+
+    template<typename Func>
+    void for_each_marked(Func &&func);
+
+    template<typename Func>
+    void for_each_unmarked(Func &&func);
+
+    // calls func(slot) for every candidate, which stops being one
+    template<typename Func>
+    void take_candidates(Func &&func);
+
+    pool_class classes[pool_class_count];
+    pool_page *all_pages = nullptr;
+    std::size_t large_page_count = 0;
+    std::size_t candidate_count = 0;
+
+private:
+    template<typename Select, typename Func>
+    void for_each_slot(Select &&select, Func &&func);
+
+    pool_page *new_page(std::size_t page_bytes, std::size_t slot_size, pool_class *owner);
+    void free_page(pool_page *page);
+    void *large_allocate(std::size_t size);
+};
+
+
+inline pool_page *pool_page_of(const void *p) {
+    return reinterpret_cast<pool_page*>(reinterpret_cast<std::uintptr_t>(p) & ~(pool_page_size - 1));
+}
+
+
+inline std::size_t pool_slot_index(const pool_page *page, const void *p) {
+    return static_cast<std::size_t>(static_cast<const char*>(p) - page->slots) / page->slot_size;
+}
+
+
+// returns true if p was not marked before
+inline bool pool_mark(const void *p) {
+    pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    std::uint64_t &word = page->mark_bits[index / 64];
+
+    if(word & bit)
+        return false;
+    word |= bit;
+    return true;
+}
+
+
+// the same, for marking threads running concurrently
+inline bool pool_mark_atomic(const void *p) {
+    pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    return !(__atomic_fetch_or(&page->mark_bits[index / 64], bit, __ATOMIC_RELAXED) & bit);
+}
+
+
+inline bool pool_is_live(const void *p) {
+    const pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    return page->live_bits[index / 64] & (std::uint64_t(1) << (index % 64));
+}
+
+
+inline bool pool_is_marked(const void *p) {
+    const pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    return page->mark_bits[index / 64] & (std::uint64_t(1) << (index % 64));
+}
+
+
+inline void pool_set_live(const void *p) {
+    pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    page->live_bits[index / 64] |= std::uint64_t(1) << (index % 64);
+}
+
+
+// gc::allocator blocks of up to max_block_size bytes come from power-of-two bins. every thread keeps
+// a free list per bin, so a block is taken and given back without a lock. a thread that runs out
+// takes block_batch_bytes worth of blocks at once from the central lists, and hands half of its own
+// back once it holds twice that. the central lists carve new blocks out of block_chunk_size chunks,
+// which stay with the process: a block that's freed goes back to a bin, never to its chunk, so the
+// memory blocks have taken at their peak stays taken until exit
+constexpr std::size_t min_block_size = 16;
+constexpr std::size_t max_block_size = 4096;
+constexpr std::size_t block_bin_count = 9;
+constexpr std::size_t block_batch_bytes = 16 * 1024;
+constexpr std::size_t block_chunk_size = 256 * 1024;
+
+
+constexpr std::size_t block_bin_index(std::size_t size) {
+    return size <= min_block_size ? 0 : 60 - __builtin_clzll(size - 1);
+}
+
+constexpr std::size_t block_bin_size(std::size_t index) { return min_block_size << index; }
+
+constexpr std::size_t block_batch_count(std::size_t index) { return block_batch_bytes / block_bin_size(index); }
+
+
+struct block_bin {
+    void *first;
+    std::size_t count;
+};
+
+
+inline thread_local block_bin block_cache[block_bin_count] = {};
+
+
+// these move blocks between the calling thread's bin and the central one
+void *refill_block_bin(std::size_t index);
+void drain_block_bin(std::size_t index, std::size_t count) noexcept;
+
+
+inline void *allocate_block(std::size_t size) {
+    std::size_t index = block_bin_index(size);
+    block_bin &bin = block_cache[index];
+    if(void *p = bin.first) {
+        bin.first = *static_cast<void**>(p);
+        --bin.count;
+        return p;
+    }
+    return refill_block_bin(index);
+}
+
+
+inline void deallocate_block(void *p, std::size_t size) noexcept {
+    std::size_t index = block_bin_index(size);
+    block_bin &bin = block_cache[index];
+    *static_cast<void**>(p) = bin.first;
+    bin.first = p;
+    if(++bin.count >= 2 * block_batch_count(index))
+        drain_block_bin(index, block_batch_count(index));
+}
+
+
+
+inline void pool::add_candidate(const void *p) {
+    pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    std::uint64_t &word = page->candidate_bits[index / 64];
+
+    if(!(word & bit)) {
+        word |= bit;
+        ++candidate_count;
+    }
+}
+
+
+// select(page, word) picks the slots of a bitmap word to visit
+template<typename Select, typename Func>
+void pool::for_each_slot(Select &&select, Func &&func) {
+    for(pool_page *page = all_pages; page; page = page->next_all) {
+        for(std::size_t w = 0; w * 64 < page->capacity; ++w) {
+            std::uint64_t bits = select(page, w);
+
+            while(bits) {
+                std::size_t index = w * 64 + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                func(page->slots + index * page->slot_size);
+            }
+        }
+    }
+}
+
+
+template<typename Func>
+void pool::for_each_live(Func &&func) {
+    for_each_slot([](pool_page *page, std::size_t w) { return page->live_bits[w]; }, func);
+}
+
+
+template<typename Func>
+void pool::for_each_marked(Func &&func) {
+    for_each_slot([](pool_page *page, std::size_t w) { return page->live_bits[w] & page->mark_bits[w]; }, func);
+}
+
+
+template<typename Func>
+void pool::for_each_unmarked(Func &&func) {
+    for_each_slot([](pool_page *page, std::size_t w) { return page->live_bits[w] & ~page->mark_bits[w]; }, func);
+}
+
+
+template<typename Func>
+void pool::take_candidates(Func &&func) {
+    if(candidate_count == 0)
+        return;
+
+    candidate_count = 0;
+    for_each_slot([](pool_page *page, std::size_t w) { 
+        return page->live_bits[w] & std::exchange(page->candidate_bits[w], 0); 
+    }, func);
+}
+
+
+}  // namespace detail
+
+}  // namespace gc
+
+#endif
+
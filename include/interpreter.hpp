@@ -19,6 +19,15 @@ public:
     
     std::string execute(std::shared_ptr<func_def> program);
 
+    // the most bytes a single execute may allocate, 0 for no limit beyond the heap's
+    void set_allocation_budget(std::size_t bytes);
+    std::size_t get_allocation_budget() const;
+
+    // after each execute, the stacks it used keep room for at most this many entries each, so the
+    // memory of a deep or wide run goes back. 0 leaves them as they are
+    void set_max_retained_stack(std::size_t entries);
+    std::size_t get_max_retained_stack() const;
+
 private:
     std::unique_ptr<interpreter_impl> impl;
 };
@@ -60,6 +60,9 @@ public:
     void write(const char *message) { write(std::string_view(message)); }
 
     irc_message read();
+
+    // whether read() has anything to return without waiting on the socket
+    bool has_input();
     
 private:
     std::unique_ptr<irc_client_impl> impl;
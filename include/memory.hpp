@@ -5,6 +5,7 @@
 #include "object.hpp"
 
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <stack>
 #include <string>
@@ -33,24 +34,45 @@ struct frame {
 };
 
 
+struct global_size {
+    std::string name;
+    gc::retained_size size;
+};
+
+
+// how much of the heap each global keeps alive, see gc::heap::profile
+struct globals_profile {
+    std::vector<global_size> globals;   // the most retained bytes first
+    std::size_t shared_objects = 0;
+    std::size_t shared_bytes = 0;
+
+    std::string to_json() const;
+};
+
+
 class memory {
 public:
     void push_frame(std::size_t current_pos, std::size_t current_operand_count, func_ref func, array_ref params);
     std::size_t pop_frame();
     void clear_stack();
+
+    // see shrink_stack
+    void shrink_stacks(std::size_t max_entries);
    
     frame &current_frame() { return frame_stack->back(); }
     
     std::size_t call_depth() const { return frame_stack->size(); }
 
     var_ref get_local_var(std::size_t index) const;
-    var_ref get_or_add_global(const std::string &name);
+    const var_ref &get_or_add_global(const std::string &name);
     bool has_global(const std::string &name) const;
+    globals_profile profile_globals();
 
     void push_temp(object temp) { temps_stack->push_back(std::move(temp)); }
 
 private:
-    gc::anchor<std::unordered_map<std::string, var_ref>> globals;
+    gc::anchor<std::unordered_map<std::string, var_ref, std::hash<std::string>, std::equal_to<std::string>,
+        gc::allocator<std::pair<const std::string, var_ref>>>> globals;
     gc::anchor<std::vector<object>> temps_stack;
     gc::anchor<std::vector<var_ref>> local_var_stack;
     gc::anchor<std::vector<frame>> frame_stack;
@@ -7,10 +7,12 @@
 #include "variant_util.hpp"
 
 #include <cstdint>
+#include <cstring>
 #include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -26,6 +28,15 @@ struct func_def {
 };
 
 
+// an object is a single word. a double is kept as its bits plus double_offset (a nan becomes the
+// quiet nan of its sign first), which leaves these values of the top 16 bits to everything else:
+//   0x0000  a node, with the kind of ptr it came from in bits 1 to 3 and the deferred tag of the
+//           ptr in bit 0. or null, if the whole word is 0
+//   0x0001  an lvalue_ref
+//   0xfffc  an int64_t that fits in 48 bits
+//   0xfffd  a uint64_t that fits in 48 bits
+// an integer that doesn't fit gets a node of its own. this relies on nodes being 16 byte aligned,
+// and on addresses fitting in 48 bits
 class object {
 public:
     using non_null_type = std::variant<std::int64_t, std::uint64_t, double, 
@@ -35,39 +46,186 @@ public:
     using int_type = std::variant<std::int64_t, std::uint64_t>; 
     //using nullable_int_type = variant_push_t<std::monostate, int_type>;
 
-    object() : val() {}
-    object(type v) : val(std::move(v)) {}
+    object() noexcept : word(null_word) {}
+    object(type v) : word(encode(std::move(v))) {}
+
+    object(const object &other) noexcept : word(other.copy_word()) {}
+
+    object(object &&other) noexcept : word(std::exchange(other.word, null_word)) { 
+        if(is_node(word))
+            gc::detail::write_barrier(get_node());
+    }
 
     object &operator=(type v) {
-        val = std::move(v);
+        std::uint64_t w = encode(std::move(v));
+        release();
+        word = w;
+        return *this;
+    }
+
+    object &operator=(const object &other) {
+        std::uint64_t w = other.copy_word();
+        release();
+        word = w;
         return *this;
     }
 
-    const type &get() const { return val; }
+    object &operator=(object &&other) {
+        if(this != &other) {
+            release();
+            word = std::exchange(other.word, null_word);
+            if(is_node(word))
+                gc::detail::write_barrier(get_node());
+        }
+        return *this;
+    }
 
-    type &get() { return val; }
+    ~object() { release(); }
+
+    // a copy of what's held. a ptr made by gc::defer comes back as an ordinary one
+    type get() const;
 
     
     value_type value() const;
 
+    // calls fn with the value value() would give, without copying it: null and numbers are passed by
+    // value, and anything else as a reference to the string_type, gcvector<object>, gcmap or
+    // func_type the node holds. the reference lasts as long as the node does
+    template<typename Func>
+    decltype(auto) visit(Func &&fn) const;
+
+    // the T value() would hold, borrowed the same way, or null if it holds something else. T is one
+    // of the types visit() passes by reference
+    template<typename T>
+    T *get_if() const;
+
+    // an object with the value value() would give: this one's own, moved out, or a copy of the one
+    // a var_ref or lvalue_ref refers to
+    object take_value();
+
     non_null_type non_null_value() const;
 
     std::optional<gcstring> to_optional_string(std::size_t depth = 0, std::size_t *count = nullptr, bool format = false) const;
 
     gcstring to_string(std::size_t depth = 0, std::size_t *count = nullptr, bool format = false) const;
 
+    // the string held, or else a new one made of to_string()
+    string_ref to_string_ref() const;
+
+    // the object a var_ref or lvalue_ref refers to, or null for any other value
+    object *target() const;
+
+    // the string held, if nothing but this and also refers to it, so it can be appended to in place.
+    // strings are never held by gc::defer ptrs, so their ref_count counts every reference
+    string_type *unshared_string(const object &also);
+
     int_type to_int() const;
 
     bool to_bool() const;
 
 
-    void transverse(gc::action &act) { act(val); }
+    void transverse(gc::action &act) { 
+        if(is_node(word) && gc::detail::untag(get_node()))
+            gc::detail::perform(get_node(), act);
+    }
 
 private:
-    type val;
+    static constexpr std::uint64_t null_word = 0;
+    static constexpr std::uint64_t payload_mask = (std::uint64_t(1) << 48) - 1;
+    static constexpr std::uint64_t kind_mask = 0xe;
+    static constexpr std::uint64_t double_offset = std::uint64_t(2) << 48;
+    static constexpr std::uint64_t lvalue_tag = std::uint64_t(0x0001) << 48;
+    static constexpr std::uint64_t int_tag = std::uint64_t(0xfffc) << 48;
+    static constexpr std::uint64_t uint_tag = std::uint64_t(0xfffd) << 48;
+
+    enum node_kind : std::uint64_t {
+        string_kind = 1 << 1, array_kind = 2 << 1, map_kind = 3 << 1, func_kind = 4 << 1, var_kind = 5 << 1,
+        int_kind = 6 << 1, uint_kind = 7 << 1
+    };
+
+    static bool is_node(std::uint64_t w) noexcept { return (w >> 48) == 0 && w != null_word; }
+
+    template<typename T>
+    static T &node_value(gc::detail::node *n) {
+        return static_cast<gc::detail::object<T>*>(gc::detail::untag(n))->value;
+    }
+
+    static double to_double(std::uint64_t w) noexcept {
+        std::uint64_t bits = w - double_offset;
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    gc::detail::node *get_node() const noexcept { 
+        return reinterpret_cast<gc::detail::node*>(word & payload_mask & ~kind_mask); 
+    }
+
+    std::uint64_t copy_word() const noexcept {
+        if(!is_node(word))
+            return word;
+        return reinterpret_cast<std::uintptr_t>(gc::detail::add_ref(get_node())) | (word & kind_mask);
+    }
+
+    void release() {
+        if(is_node(word) && gc::detail::untag(get_node()))
+            gc::detail::remove_ref(get_node());
+    }
+
+    static std::uint64_t encode(type &&v);
+
+    template<typename Variant>
+    Variant decode() const;
+
+    std::uint64_t word;
 };
 
 
+template<typename Func>
+decltype(auto) object::visit(Func &&fn) const {
+    const object *obj = this;
+    while(const object *t = obj->target())
+        obj = t;
+
+    switch(obj->word >> 48) {
+    case 0:
+        if(obj->word == null_word || !gc::detail::untag(obj->get_node()))
+            return fn(std::monostate());
+        switch(obj->word & kind_mask) {
+        case string_kind: return fn(node_value<string_type>(obj->get_node()));
+        case array_kind: return fn(node_value<gcvector<object>>(obj->get_node()));
+        case map_kind: return fn(node_value<gcmap>(obj->get_node()));
+        case func_kind: return fn(node_value<func_type>(obj->get_node()));
+        case int_kind: return fn(std::int64_t(node_value<std::int64_t>(obj->get_node())));
+        default: return fn(std::uint64_t(node_value<std::uint64_t>(obj->get_node())));
+        }
+    case int_tag >> 48: return fn(static_cast<std::int64_t>(obj->word << 16) >> 16);
+    case uint_tag >> 48: return fn(std::uint64_t(obj->word & payload_mask));
+    default: return fn(to_double(obj->word));
+    }
+}
+
+
+template<typename T>
+T *object::get_if() const {
+    return visit([](auto &&v) -> T* {
+        if constexpr(std::is_same_v<std::decay_t<decltype(v)>, T>)
+            return &v;
+        else
+            return nullptr;
+    });
+}
+
+
+// visits both objects' values at once, like std::visit with two variants
+template<typename Func>
+decltype(auto) visit(Func &&fn, const object &left, const object &right) {
+    return left.visit([&](auto &&l) -> decltype(auto) {
+        return right.visit([&](auto &&r) -> decltype(auto) { return fn(l, r); });
+    });
+}
+
+
 inline array_ref make_array() { return gc::make_ptr<gcvector<object>>(); }
 
 inline map_ref make_map() { return gc::make_ptr<gcmap>(); }
@@ -76,21 +234,19 @@ inline var_ref make_lvalue(object::type value = std::monostate()) {
     return gc::make_ptr<object>(std::move(value));
 }
 
-inline string_ref make_string(gcstring str) { 
-    return std::allocate_shared<gcstring>(gc::allocator<gcstring>(), std::move(str)); 
-}
+inline string_ref make_string(std::string_view str) { return gc::make_ptr<string_type>(str); }
 
-inline string_ref make_string(std::string_view str) {
-    return std::allocate_shared<gcstring>(gc::allocator<gcstring>(), str.begin(), str.end());
+inline string_ref make_string(std::string_view left, std::string_view right) { 
+    return gc::make_ptr<string_type>(left, right); 
 }
 
 
 
-inline gc::anchor<object> pop(std::vector<object> &v) {
+inline gc::root<object> pop(std::vector<object> &v) {
     if(debug && v.empty())
         debug_throw("calling pop() on empty vector<object>!");
 
-    gc::anchor<object> value = std::move(v.back());
+    gc::root<object> value = std::move(v.back());
     v.pop_back();
     return value;
 }
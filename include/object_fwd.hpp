@@ -2,12 +2,16 @@
 #define LIPH_OBJECT_FWD_HPP
 
 #include "gc.hpp"
+#include "ordered_map.hpp"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <functional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
 
@@ -18,22 +22,122 @@ class func_def;
 using gcstring = std::basic_string<char, std::char_traits<char>, gc::allocator<char>>;
 
 
-namespace std {
-    template<>
-    struct hash<gcstring> {
-        std::size_t operator()(const gcstring &str) const {
-            return hash<std::string_view>()(std::string_view(str.data(), str.size()));
+// a script string. it only changes by append(), while nothing else refers to it, so its hash is
+// worked out the first time it's needed and then kept. up to small_size chars are kept in the string
+// itself, longer ones in a gc::allocator block with room to grow
+class string_type {
+public:
+    static constexpr std::size_t small_size = 24;
+
+    explicit string_type(std::string_view str) : string_type(str, std::string_view()) {}
+
+    // the two joined
+    string_type(std::string_view left, std::string_view right) : length(checked_length(left.size() + right.size())) {
+        char *out = chars.small;
+        if(!is_small())
+            out = chars.large.data = gc::allocator<char>().allocate(chars.large.capacity = length);
+        std::copy(right.begin(), right.end(), std::copy(left.begin(), left.end(), out));
+    }
+
+    string_type(const string_type &) = delete;
+    string_type &operator=(const string_type &) = delete;
+
+    ~string_type() {
+        if(!is_small())
+            gc::allocator<char>().deallocate(chars.large.data, chars.large.capacity);
+    }
+
+    const char *data() const { return is_small() ? chars.small : chars.large.data; }
+    std::size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    std::string_view view() const { return std::string_view(data(), length); }
+
+    std::size_t hash() const noexcept {
+        if(!hash_value)
+            hash_value = hash_of(view());
+        return hash_value;
+    }
+
+    // what hash() is for a string of these chars
+    static std::uint32_t hash_of(std::string_view str) noexcept {
+        std::uint32_t h = static_cast<std::uint32_t>(std::hash<std::string_view>()(str));
+        return h ? h : 1;
+    }
+
+    // adds str to the end in place, doubling the room when it runs out. str mustn't point into this string
+    void append(std::string_view str) {
+        std::uint32_t new_length = checked_length(length + str.size());
+        std::size_t capacity = is_small() ? small_size : chars.large.capacity;
+        char *out = is_small() ? chars.small : chars.large.data;
+
+        if(new_length > capacity) {
+            std::size_t new_capacity = std::max<std::size_t>(new_length, 2 * capacity);
+            char *grown = gc::allocator<char>().allocate(new_capacity);
+            std::copy(out, out + length, grown);
+            if(!is_small())
+                gc::allocator<char>().deallocate(chars.large.data, chars.large.capacity);
+            chars.large.data = out = grown;
+            chars.large.capacity = new_capacity;
         }
-    };
-}
+
+        std::copy(str.begin(), str.end(), out + length);
+        length = new_length;
+        hash_value = 0;
+    }
+
+    std::size_t storage_size() const { 
+        return is_small() ? 0 : gc::detail::malloc_allocation_size(chars.large.capacity); 
+    }
+
+private:
+    static std::uint32_t checked_length(std::size_t size) {
+        if(size > std::numeric_limits<std::uint32_t>::max())
+            throw std::length_error("string too long");
+        return static_cast<std::uint32_t>(size);
+    }
+
+    bool is_small() const { return length <= small_size; }
+
+    std::uint32_t length;
+    mutable std::uint32_t hash_value = 0;     // 0 until it's worked out
+    union {
+        char small[small_size];
+        struct {
+            char *data;
+            std::size_t capacity;
+        } large;
+    } chars;
+};
+
+
+using string_ref = gc::ptr<string_type>;
+
+
+// map keys are strings, compared by content. a key can be looked up by a string_type or a
+// string_view too, without making a string_ref for it
+struct string_ref_hash {
+    std::size_t operator()(const string_ref &str) const noexcept { return str->hash(); }
+    std::size_t operator()(const string_type &str) const noexcept { return str.hash(); }
+    std::size_t operator()(std::string_view str) const noexcept { return string_type::hash_of(str); }
+};
+
+// ordered_map only calls these once the hashes match
+struct string_ref_equal {
+    bool operator()(const string_ref &left, const string_ref &right) const { return (*this)(left, *right); }
+    bool operator()(const string_ref &left, const string_type &right) const {
+        return left.get() == &right || left->view() == right.view();
+    }
+    bool operator()(const string_ref &left, std::string_view right) const { return left->view() == right; }
+};
 
 
 template<typename T>
 using gcvector = std::vector<T, gc::allocator<T>>;
 
-using gcmap = std::unordered_map<gcstring, object>;
+// iterates in the order the keys were added
+using gcmap = ordered_map<string_ref, object, string_ref_hash, string_ref_equal, 
+      gc::allocator<std::pair<string_ref, object>>>;
 
-using string_ref = std::shared_ptr<gcstring>;
 using array_ref = gc::ptr<gcvector<object>>;
 using map_ref = gc::ptr<gcmap>;
 using var_ref = gc::ptr<object>;    // a named variable (a global variable or capture, or currently, a local variable)
@@ -46,6 +150,8 @@ struct func_type {
    
     void transverse(gc::action &act) { act(captures); }
 
+    std::size_t storage_size() const { return gc::storage_size<gcvector<var_ref>>()(captures); }
+
     std::shared_ptr<func_def> definition;
     gcvector<var_ref> captures;
 };
@@ -0,0 +1,253 @@
+#ifndef LIPH_ORDERED_MAP_HPP
+#define LIPH_ORDERED_MAP_HPP
+
+#include "gc.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// a hash map that keeps its entries in the order they were added, found through an open addressing
+// table (linear probing) of their indexes. each slot keeps 32 bits of its entry's hash too, so probing
+// past other entries rarely has to look at their keys. the entries sit in blocks that double in size,
+// so adding one never moves the others: a pointer to a value stays good until the map is destroyed.
+// find() takes anything Hash and Equal do, not just a Key. Hash, Equal and Allocator are made where
+// they're used, so they mustn't have state. a key mustn't be changed, and nothing is ever removed
+template<typename Key, typename T, typename Hash, typename Equal, typename Allocator>
+class ordered_map {
+public:
+    using value_type = std::pair<Key, T>;
+
+    template<bool Const>
+    class basic_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ordered_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        basic_iterator() = default;
+        operator basic_iterator<true>() const { return basic_iterator<true>(map, index, block, p, block_end); }
+
+        reference operator*() const { return *p; }
+        pointer operator->() const { return p; }
+
+        basic_iterator &operator++() {
+            ++index;
+            if(++p == block_end && ++block < map->blocks.size()) {
+                p = map->blocks[block];
+                block_end = p + block_size(block);
+            }
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const basic_iterator &other) const { return index == other.index; }
+        bool operator!=(const basic_iterator &other) const { return index != other.index; }
+
+    private:
+        friend class ordered_map;
+        friend class basic_iterator<!Const>;
+
+        basic_iterator(const ordered_map *map, std::size_t index, std::size_t block, value_type *p, value_type *block_end)
+            : map(map), index(index), block(block), p(p), block_end(block_end) {}
+
+        // past the last block there's nothing to point at
+        basic_iterator(const ordered_map *map, std::size_t index) : map(map), index(index), block(block_of(index)) {
+            if(block < map->blocks.size()) {
+                p = map->blocks[block] + (index - block_start(block));
+                block_end = map->blocks[block] + block_size(block);
+            }
+        }
+
+        const ordered_map *map = nullptr;
+        std::size_t index = 0;
+        std::size_t block = 0;
+        value_type *p = nullptr;
+        value_type *block_end = nullptr;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    ordered_map() = default;
+    ordered_map(const ordered_map &) = delete;
+    ordered_map &operator=(const ordered_map &) = delete;
+
+    ~ordered_map() {
+        Allocator alloc;
+        for(std::size_t b = 0; b < blocks.size(); ++b) {
+            std::size_t used = std::min(block_size(b), count - std::min(count, block_start(b)));
+            for(std::size_t i = 0; i < used; ++i)
+                std::allocator_traits<Allocator>::destroy(alloc, blocks[b] + i);
+            std::allocator_traits<Allocator>::deallocate(alloc, blocks[b], block_size(b));
+        }
+    }
+
+    iterator begin() noexcept { return iterator(this, 0); }
+    iterator end() noexcept { return iterator(this, count); }
+    const_iterator begin() const noexcept { return const_iterator(this, 0); }
+    const_iterator end() const noexcept { return const_iterator(this, count); }
+
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+
+    void reserve(std::size_t n) {
+        while(block_start(blocks.size()) < n)
+            add_block();
+        if(n > max_load(slots.size()))
+            rehash(n);
+    }
+
+    template<typename K>
+    iterator find(const K &key) {
+        if(slots.empty())
+            return end();
+        const slot &s = slots[find_slot(key, hash_of(key))];
+        return s.index ? iterator(this, s.index - 1) : end();
+    }
+
+    template<typename K>
+    const_iterator find(const K &key) const { return const_cast<ordered_map*>(this)->find(key); }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key &key, Args&&... args) {
+        return emplace_key(key, std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key &&key, Args&&... args) {
+        return emplace_key(std::move(key), std::forward<Args>(args)...);
+    }
+
+    std::size_t storage_size() const {
+        std::size_t size = gc::storage_size<std::vector<value_type*, pointer_allocator>>()(blocks)
+            + gc::storage_size<std::vector<slot, slot_allocator>>()(slots);
+        for(std::size_t b = 0; b < blocks.size(); ++b)
+            size += gc::detail::malloc_allocation_size(block_size(b) * sizeof(value_type));
+        for(const value_type &entry : *this)
+            size += gc::storage_size<value_type>()(entry);
+        return size;
+    }
+
+private:
+    struct slot {
+        std::uint32_t hash;
+        std::uint32_t index;    // 1 more than the entry's, or 0 for an empty slot
+    };
+
+    using slot_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slot>;
+    using pointer_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<value_type*>;
+
+    static constexpr std::size_t first_block_bits = 2;
+    static constexpr std::size_t min_slots = 8;
+    static constexpr std::size_t max_entries = std::numeric_limits<std::uint32_t>::max();
+
+    // block b holds entries [block_start(b), block_start(b + 1))
+    static std::size_t block_size(std::size_t b) { return std::size_t(1) << (b + first_block_bits); }
+    static std::size_t block_start(std::size_t b) { return ((std::size_t(1) << b) - 1) << first_block_bits; }
+    static std::size_t block_of(std::size_t index) {
+        return 63 - __builtin_clzll((index >> first_block_bits) + 1);
+    }
+
+    value_type &entry(std::size_t index) const {
+        std::size_t b = block_of(index);
+        return blocks[b][index - block_start(b)];
+    }
+
+    // at most 3/4 of the slots are used
+    static std::size_t max_load(std::size_t slot_count) { return slot_count - slot_count / 4; }
+
+    template<typename K>
+    static std::uint32_t hash_of(const K &key) { return static_cast<std::uint32_t>(Hash()(key)); }
+
+    // where probing for a hash starts: its top bits once multiplied by 2^32 / phi, which spreads
+    // out hashes that only differ in their high bits
+    std::size_t home(std::uint32_t hash) const { return static_cast<std::uint32_t>(hash * 2654435769u) >> shift; }
+
+    // the slot holding key, or else the empty one it would go in
+    template<typename K>
+    std::size_t find_slot(const K &key, std::uint32_t hash) const {
+        std::size_t mask = slots.size() - 1;
+        for(std::size_t i = home(hash); ; i = (i + 1) & mask) {
+            const slot &s = slots[i];
+            if(!s.index || (s.hash == hash && Equal()(entry(s.index - 1).first, key)))
+                return i;
+        }
+    }
+
+    std::size_t free_slot(std::uint32_t hash) const {
+        std::size_t mask = slots.size() - 1;
+        std::size_t i = home(hash);
+        while(slots[i].index)
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    // makes room for n entries, with the slots put back in their new places
+    void rehash(std::size_t n) {
+        std::size_t slot_count = min_slots;
+        while(max_load(slot_count) < n)
+            slot_count *= 2;
+
+        std::vector<slot, slot_allocator> old(slot_count, slot{0, 0});
+        old.swap(slots);
+        shift = __builtin_clzll(slot_count) - 31;
+
+        for(const slot &s : old) {
+            if(s.index)
+                slots[free_slot(s.hash)] = s;
+        }
+    }
+
+    void add_block() {
+        blocks.reserve(blocks.size() + 1);
+        Allocator alloc;
+        blocks.push_back(std::allocator_traits<Allocator>::allocate(alloc, block_size(blocks.size())));
+    }
+
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> emplace_key(K &&key, Args&&... args) {
+        std::uint32_t hash = hash_of(key);
+        if(!slots.empty()) {
+            const slot &s = slots[find_slot(key, hash)];
+            if(s.index)
+                return {iterator(this, s.index - 1), false};
+        }
+
+        if(count == max_entries)
+            throw std::length_error("ordered_map is full");
+        if(count + 1 > max_load(slots.size()))
+            rehash(count + 1);
+        if(count == block_start(blocks.size()))
+            add_block();
+
+        Allocator alloc;
+        std::allocator_traits<Allocator>::construct(alloc, &entry(count), std::piecewise_construct,
+                std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        slots[free_slot(hash)] = {hash, static_cast<std::uint32_t>(++count)};
+        return {iterator(this, count - 1), true};
+    }
+
+    std::vector<value_type*, pointer_allocator> blocks;
+    std::vector<slot, slot_allocator> slots;
+    std::size_t count = 0;
+    unsigned shift = 32;     // 32 - log2 of slots.size()
+};
+
+
+#endif
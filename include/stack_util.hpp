@@ -2,6 +2,10 @@
 #define LIPH_STACK_UTIL_HPP
 
 #include "debug.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
 #include <stack>
 #include <utility>
 #include <vector>
@@ -18,4 +22,21 @@ T pop(std::stack<T> &s) {
 }
 
 
+
+// gives back the memory of a vector that has grown past max_capacity, keeping room for that many.
+// if the smaller one can't be allocated, it's left as it is
+template<typename T, typename Alloc>
+void shrink_stack(std::vector<T, Alloc> &v, std::size_t max_capacity) {
+    if(v.capacity() <= max_capacity)
+        return;
+
+    try {
+        std::vector<T, Alloc> smaller(v.get_allocator());
+        smaller.reserve(std::max(v.size(), max_capacity));
+        std::move(v.begin(), v.end(), std::back_inserter(smaller));
+        v.swap(smaller);
+    } catch(std::bad_alloc &) {}
+}
+
+
 #endif
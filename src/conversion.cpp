@@ -11,12 +11,12 @@
 thread_local std::basic_stringstream<char, std::char_traits<char>, gc::allocator<char>> ss;
 
 
-std::optional<gcstring> to_optional_string(const string_ref &s, std::size_t, std::size_t *, bool format) {
+std::optional<gcstring> to_optional_string(const string_type &s, std::size_t, std::size_t *, bool format) {
     if(!format) 
-        return {*s};
+        return gcstring(s.data(), s.size());
 
     gcstring result("\"");
-    for(char ch : *s) {
+    for(char ch : s.view()) {
         if(ch == '\"')
             result += "\\\"";
         else if(ch == '\\')
@@ -37,8 +37,8 @@ std::optional<gcstring> to_optional_string(double v, std::size_t, std::size_t *,
 }
 
 
-std::optional<gcstring> to_optional_string(const array_ref &ref, std::size_t depth, std::size_t *count, bool) {
-    if(ref->empty())
+std::optional<gcstring> to_optional_string(const gcvector<object> &arr, std::size_t depth, std::size_t *count, bool) {
+    if(arr.empty())
         return {"[]"};
     if(depth >= 20)
         return "...";
@@ -52,7 +52,7 @@ std::optional<gcstring> to_optional_string(const array_ref &ref, std::size_t dep
 
     gcstring out("[");
 
-    for(const object &obj : *ref)
+    for(const object &obj : arr)
         out += obj.to_string(depth+1, &++*count, true) + ", ";
 
     out.pop_back();
@@ -61,8 +61,8 @@ std::optional<gcstring> to_optional_string(const array_ref &ref, std::size_t dep
 }
 
 
-std::optional<gcstring> to_optional_string(const map_ref &ref, std::size_t depth, std::size_t *count, bool) {
-    if(ref->empty())
+std::optional<gcstring> to_optional_string(const gcmap &map, std::size_t depth, std::size_t *count, bool) {
+    if(map.empty())
         return {"{}"};
     if(depth >= 20)
         return "...";
@@ -76,8 +76,10 @@ std::optional<gcstring> to_optional_string(const map_ref &ref, std::size_t depth
                   
     gcstring out("{");
 
-    for(const auto &keypair : *ref)
-        out += keypair.first + ": " + keypair.second.to_string(depth+1, &++*count, true) + ", ";
+    for(const auto &keypair : map) {
+        out += keypair.first->view();
+        out += ": " + keypair.second.to_string(depth+1, &++*count, true) + ", ";
+    }
 
     out.pop_back();
     out.back() = '}';
@@ -85,7 +87,7 @@ std::optional<gcstring> to_optional_string(const map_ref &ref, std::size_t depth
 }
 
 
-std::optional<gcstring> to_optional_string(const func_ref &ref, std::size_t depth, std::size_t *count, bool) {
+std::optional<gcstring> to_optional_string(const func_type &func, std::size_t depth, std::size_t *count, bool) {
     if(depth >= 20)
         return "...";
 
@@ -96,12 +98,12 @@ std::optional<gcstring> to_optional_string(const func_ref &ref, std::size_t dept
     if(*count > 1000)
         return "...";
 
-    gcstring out = ref->definition->source_text;
+    gcstring out = func.definition->source_text;
 
-    if(!ref->captures.empty()) {
+    if(!func.captures.empty()) {
         out += " with [";
 
-        for(const auto &capture : ref->captures) {
+        for(const auto &capture : func.captures) {
             out += capture->to_string(depth+1, &++*count, true) + ", ";
         }
 
@@ -7,6 +7,7 @@
 #include <limits>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <type_traits>
 #include <variant>
@@ -18,20 +19,30 @@ using namespace std::string_literals;
 namespace executor {
 
 
+// the text of one side of a string +. a string is used as it is, anything else is converted into buffer
+std::string_view string_text(const object &, const string_type &str, gcstring &) { return str.view(); }
+
+template<typename T>
+std::string_view string_text(const object &obj, const T &, gcstring &buffer) {
+    buffer = obj.to_string();
+    return buffer;
+}
+
+
 object binary_arithmetic(op_code code, const object &left, const object &right) {
-    // TODO: operator+ for arrays?
-    if (std::holds_alternative<string_ref>(left.value()) 
-            || std::holds_alternative<string_ref>(right.value())) {
-        if(code == op_code::add) {
-            return object::type(make_string(left.to_string() + right.to_string()));
-        } else {
-            throw std::runtime_error("String does not support "s + lookup_operation(code).symbol);
-        }
-    } else {
-        return std::visit([code](auto &&l, auto &&r) -> object::type {
-            using LeftT = std::decay_t<decltype(l)>;
-            using RightT = std::decay_t<decltype(r)>;
+    return visit([&](auto &&l, auto &&r) -> object::type {
+        using LeftT = std::decay_t<decltype(l)>;
+        using RightT = std::decay_t<decltype(r)>;
 
+        // TODO: operator+ for arrays?
+        if constexpr(std::is_same_v<LeftT, string_type> || std::is_same_v<RightT, string_type>) {
+            if(code != op_code::add)
+                throw std::runtime_error("String does not support "s + lookup_operation(code).symbol);
+            gcstring left_buffer, right_buffer;
+            return object::type(make_string(string_text(left, l, left_buffer), string_text(right, r, right_buffer)));
+        } else if constexpr(std::is_same_v<LeftT, std::monostate> || std::is_same_v<RightT, std::monostate>) {
+            throw std::runtime_error("unexpected null value");
+        } else {
             if constexpr(!std::is_arithmetic_v<LeftT> || !std::is_arithmetic_v<RightT>) {
                 throw std::runtime_error("Performing "s + lookup_operation(code).symbol + " on non-arithmetic type type");
             } else {
@@ -55,8 +66,30 @@ object binary_arithmetic(op_code code, const object &left, const object &right)
                     throw std::logic_error("Invalid binary_arithmetic op: "s + lookup_operation(code).symbol);
                 }
             }
-        }, left.non_null_value(), right.non_null_value());
-    }
+        }
+    }, left, right);
+}
+
+
+bool append_assign(const object &left, const object &right, const object &replaced) {
+    object *target = left.target();
+    if(!target)
+        return false;
+
+    string_type *str = target->unshared_string(replaced);
+    if(!str)
+        return false;
+
+    return right.visit([&](auto &&r) {
+        // s += s would read the string while it's being reallocated
+        if constexpr(std::is_same_v<std::decay_t<decltype(r)>, string_type>) {
+            if(&r == str)
+                return false;
+        }
+        gcstring buffer;
+        str->append(string_text(right, r, buffer));
+        return true;
+    });
 }
 
 
@@ -8,6 +8,7 @@
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <variant>
 
@@ -33,31 +34,44 @@ bool do_binary_comp(op_code code, const std::optional<T> &l, const std::optional
 }
 
 
+// numbers are compared by value, arrays, maps and functions by which one they are
+template<typename T>
+auto comparable(const T &v) {
+    if constexpr(std::is_arithmetic_v<T>)
+        return v;
+    else
+        return &v;
+}
+
+
 bool binary_comp(op_code code, const object &left, const object &right) {
 
     switch(code) {
     case op_code::logic_and: return left.to_bool() && right.to_bool();
     case op_code::logic_or:  return left.to_bool() || right.to_bool();
     default:
-        return std::visit([code](auto &&left, auto &&right) -> bool {
+        return visit([code](auto &&left, auto &&right) -> bool {
             using L = std::decay_t<decltype(left)>;
             using R = std::decay_t<decltype(right)>;
 
             if constexpr(std::is_same_v<L, std::monostate> && std::is_same_v<R, std::monostate>) {
                 return do_binary_comp(code, std::optional<int>(), std::optional<int>());
-            } else if constexpr(std::is_same_v<L, string_ref> || std::is_same_v<R, string_ref>) {
+            } else if constexpr(std::is_same_v<L, string_type> && std::is_same_v<R, string_type>) {
+                return do_binary_comp(code, std::optional<std::string_view>(left.view()), 
+                        std::optional<std::string_view>(right.view()));
+            } else if constexpr(std::is_same_v<L, string_type> || std::is_same_v<R, string_type>) {
                 return do_binary_comp(code, to_optional_string(left), to_optional_string(right));
             } else if constexpr(std::is_same_v<L, std::monostate>) {
-                return do_binary_comp(code, std::optional<R>(), std::optional<R>(right));
+                return do_binary_comp(code, std::optional<decltype(comparable(right))>(), std::optional(comparable(right)));
             } else if constexpr(std::is_same_v<R, std::monostate>) {
-                return do_binary_comp(code, std::optional<L>(left), std::optional<L>());
+                return do_binary_comp(code, std::optional(comparable(left)), std::optional<decltype(comparable(left))>());
             // TODO: deep comparison of array_ref? (and map_ref?)
             } else if constexpr((std::is_arithmetic_v<L> && std::is_arithmetic_v<R>) || std::is_same_v<L, R>) {
-                return do_binary_comp(code, std::optional<L>(left), std::optional<R>(right));
+                return do_binary_comp(code, std::optional(comparable(left)), std::optional(comparable(right)));
             } else {
                 throw std::runtime_error("Performing "s + lookup_operation(code).symbol + " between different types");
             }
-        }, left.value(), right.value());
+        }, left, right);
     }
 }
 
@@ -5,7 +5,9 @@
 #include "object.hpp"
 #include "operation_type.hpp"
 
+#include <charconv>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <type_traits>
 #include <variant>
@@ -18,33 +20,45 @@ namespace executor {
 
 
 object index_op(memory *mem, const object &left, const object &right) {
-    bool temp = !std::holds_alternative<lvalue_ref>(left.get()) 
-        && !std::holds_alternative<var_ref>(left.get()); 
+    bool temp = !left.target();
     //debug_out(temp ? "temp=true" : "temp=false");
     if(temp)
         mem->push_temp(left);
 
-    return object::type(std::visit([](auto &&l, auto &&r) -> lvalue_ref {
+    return object::type(visit([&right](auto &&l, auto &&r) -> lvalue_ref {
         using L = std::decay_t<decltype(l)>;
         using R = std::decay_t<decltype(r)>;
 
-        if constexpr(std::is_same_v<L, array_ref>) {
+        if constexpr(std::is_same_v<L, std::monostate> || std::is_same_v<R, std::monostate>) {
+            throw std::runtime_error("unexpected null value");
+        } else if constexpr(std::is_same_v<L, gcvector<object>>) {
             std::int64_t index = to_int(r);
-            if(index < 0 || static_cast<std::size_t>(index) >= l->size())
+            if(index < 0 || static_cast<std::size_t>(index) >= l.size())
                 throw std::runtime_error("array index out of bounds: " + std::to_string(index) 
-                        + ", size: " + std::to_string(l->size()));
-            return &(*l)[index];
-        } else if constexpr(std::is_same_v<L, map_ref>) {
-            if constexpr(std::is_integral_v<R> || std::is_same_v<R, string_ref>) {
-                return &l->try_emplace(to_str(r), std::monostate()).first->second;
+                        + ", size: " + std::to_string(l.size()));
+            return &l[index];
+        } else if constexpr(std::is_same_v<L, gcmap>) {
+            // only a new key needs a string_ref of its own
+            if constexpr(std::is_same_v<R, string_type>) {
+                auto it = l.find(r);
+                if(it == l.end())
+                    it = l.try_emplace(right.to_string_ref(), std::monostate()).first;
+                return &it->second;
+            } else if constexpr(std::is_integral_v<R>) {
+                char digits[24];
+                std::string_view key(digits, std::to_chars(digits, digits + sizeof(digits), r).ptr - digits);
+                auto it = l.find(key);
+                if(it == l.end())
+                    it = l.try_emplace(make_string(key), std::monostate()).first;
+                return &it->second;
             } else {
                 throw std::runtime_error("map index with non-string/non-int type");
             }
-        //} else if constexpr(std::is_same_v<L, string_ref>) {  // TODO: string indexing
+        //} else if constexpr(std::is_same_v<L, string_type>) {  // TODO: string indexing
         } else {
             throw std::runtime_error("object does not support []");
         }
-    }, left.non_null_value(), right.non_null_value()));
+    }, left, right));
 }
 
 
@@ -6,7 +6,6 @@
 #include "operation_type.hpp"
 #include "stack_util.hpp"
 #include "string_util.hpp"
-#include "variant_util.hpp"
 
 #include <string>
 #include <stdexcept>
@@ -25,7 +24,7 @@ bool unary_op(gc::anchor<object> &last_value, std::vector<object> &operands, std
     if(code == op_code::semicolon || code == op_code::ret) {
         //std::cout << "semicolon: " << operands.size() << ", " << parent_operand_count << std::endl;
         if(operands.size() > parent_operand_count)
-            last_value = to_variant<object::type>(pop(operands)->value());  // TODO: make last_value gc::anchor<object::value_type>?
+            last_value = pop(operands)->take_value();
         //operands.clear();   // TODO: should i do this?
         return code == op_code::ret;
     }
@@ -37,24 +36,27 @@ bool unary_op(gc::anchor<object> &last_value, std::vector<object> &operands, std
 
     bool is_pre = (code == op_code::pre_inc || code == op_code::pre_dec);
     bool is_post = (code == op_code::post_inc || code == op_code::post_dec);
-    object operand = is_pre ? operands.back() : *pop(operands);
+    gc::root<object> popped = is_pre ? gc::root<object>() : pop(operands);
+    const object &operand = is_pre ? operands.back() : *popped;
     
     if(is_post)
-        operands.push_back(to_variant<object::type>(operand.value()));
+        operands.push_back(operand.target() ? *operand.target() : operand);
 
     if(code == op_code::logic_not) {
         operands.push_back(object(static_cast<std::int64_t>(!operand.to_bool())));
         return false;
     }
 
-    object result = object(std::visit([code](auto &&v) -> object::type {
+    object result = object(operand.visit([code](auto &&v) -> object::type {
         using T = std::decay_t<decltype(v)>;
-        if constexpr(std::is_same_v<T, string_ref>) {
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            throw std::runtime_error("unexpected null value");
+        } else if constexpr(std::is_same_v<T, string_type>) {
             if(code == op_code::plus) {
-                if(!v->empty() && v->front() == '-')
-                    return static_cast<std::int64_t>(std::stoll(to_std_string(*v)));
+                if(!v.empty() && v.view().front() == '-')
+                    return static_cast<std::int64_t>(std::stoll(to_std_string(v)));
                 else
-                    return static_cast<std::uint64_t>(std::stoull(to_std_string(*v)));
+                    return static_cast<std::uint64_t>(std::stoull(to_std_string(v)));
             } else {
                 throw std::runtime_error("String does not support: "s + lookup_operation(code).symbol);
             }
@@ -73,16 +75,13 @@ bool unary_op(gc::anchor<object> &last_value, std::vector<object> &operands, std
                 throw std::logic_error("Currently unsupported unary op: "s + lookup_operation(code).symbol);
             }
         }
-    }, operand.non_null_value()));
+    }));
 
     if(is_pre || is_post) {
-        if(var_ref *var = std::get_if<var_ref>(&operand.get())) {
-            **var = to_variant<object::type>(result.value());
-        } else if(lvalue_ref *lvalue = std::get_if<lvalue_ref>(&operand.get())) {
-            **lvalue = to_variant<object::type>(result.value()); 
-        } else {
+        object *target = operand.target();
+        if(!target)
             throw std::runtime_error("left of "s + lookup_operation(code).symbol + " is not assignable");
-        }
+        *target = std::move(result);
     } else {
         operands.push_back(std::move(result));
     }
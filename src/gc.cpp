@@ -1,5 +1,14 @@
 #include "gc.hpp"
+#include <algorithm>
+#include <chrono>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
 
 #ifdef DEBUG
 using namespace std::string_literals;
@@ -15,56 +24,47 @@ bool run_on_bad_alloc = true;
 namespace detail {
 
 
-node active_head;
-node temp_head;
-anchor_node anchor_head{sentinel()};
+heap default_heap;
 
-bool is_running = false;
-bool is_retrying = false;
-std::size_t nested_create_count = 0;
-std::size_t memory_used = 0;
-std::size_t memory_limit = std::numeric_limits<std::size_t>::max();
+node zct_end(0);
 
+const node_type *node_types[max_node_types];
+std::size_t node_type_count = 0;
+std::mutex node_types_lock;
 
-void debug_not_head(node *n, node *allowed_head) {
-    if(!debug)
-        return;
-    if(!n)
-        throw std::logic_error("debug_not_head: node is null");
-    if(n == allowed_head)
-        return;
-
-    if(n == &active_head)
-        throw std::logic_error("node is active_head");
-    if(n == &temp_head)
-        throw std::logic_error("node is temp_head");
-}
 
+std::uint32_t register_node_type(const node_type *type) {
+    std::lock_guard<std::mutex> guard(node_types_lock);
+    if(node_type_count == max_node_types)
+        throw std::logic_error("register_node_type: too many gc object types");
 
-struct mark_reachable_action : action {
-    // returning true means: did i do something? false means it was already marked
-    bool detail_perform(detail::node *node) override { 
-        if(debug && !node)
-            throw std::logic_error("mark_reachable_action: null");
-        return node->mark_reachable(); 
-    }
-};
+    node_types[node_type_count] = type;
+    return static_cast<std::uint32_t>(node_type_count++);
+}
 
 
 struct dec_ref_action : action {
+    dec_ref_action(heap &h) : h(h) {}
+
     bool detail_perform(detail::node *node) override { 
         if(debug && !node)
             throw std::logic_error("dec_ref_action: null");
         if(debug && node->ref_count == 0)
             debug_error("dec_ref_action: ref_count is 0");
         
-        --node->ref_count;
+        // a survivor whose only other references are deferred
+        if(--node->ref_count == 0 && h.is_deferring() && pool_is_marked(node))
+            h.zct_push(node);
         return true;
     } 
+
+    heap &h;
 };
 
 
 struct free_action : action {
+    free_action(heap &h, node_list &dying) : h(h), dying(dying) {}
+
     // returning true means: did i do something? false means this object is not ready to be freed (ref_count > 0)
     bool detail_perform(detail::node *node) override {
         if(debug && !node)
@@ -72,260 +72,1094 @@ struct free_action : action {
 
         if(node->ref_count > 1) {
             --node->ref_count;
+            h.add_candidate(node);
+            if(h.is_marking)
+                h.shade(node);
             return false;
         }
 
 		if(debug)
 			node->ref_count = 0;
-        node->list_remove();
-        node->list_insert(temp_head);
+
+        if(h.is_deferring()) {
+            // a deferred ptr may still refer to it
+            h.zct_push(node);
+            return false;
+        }
+
+        // it's dead from here on, even if destroying it waits
+        if(node->has_weak)
+            h.clear_weak(node);
+
+        if(h.is_marking && pool_is_marked(node)) {
+            // it may still be on the gray stack, so it has to outlive the cycle
+            node->ref_count = 0;
+            h.zombies.push(node);
+            return false;
+        }
+
+        dying.push(node);
         return true;
     }
+
+    heap &h;
+    node_list &dying;
 };
 
 
-void transverse_list(node &head, node *old_head, action &act) {
-    node *new_head = head.next;
+// counts (or uncounts) the deferred ptrs it's applied to
+struct count_deferred_action : action {
+    count_deferred_action(heap &h, bool increment) : h(h), increment(increment) {}
 
-    while(old_head != new_head) {
+    bool detail_perform(detail::node *) override { return true; }
+
+    bool detail_perform_deferred(detail::node *node) override {
+        ++found;
+        if(increment)
+            ++node->ref_count;
+        else if(--node->ref_count == 0)
+            h.zct_push(node);
+        return true;
+    }
+
+    heap &h;
+    bool increment;
+    std::size_t found = 0;
+};
+
+
+// the steps of trial deletion. gray_action takes the references between the nodes reachable from
+// the candidates off their counts, black_action puts them back for what turns out to be still alive
+struct gray_action : action {
+    gray_action(std::vector<node*> &gray) : gray(gray) {}
+
+    bool detail_perform(detail::node *node) override {
+        --node->ref_count;
+        if(node->color != node_color::gray) {
+            node->color = node_color::gray;
+            gray.push_back(node);
+        }
+        return true;
+    }
+
+    std::vector<node*> &gray;
+};
+
+
+struct black_action : action {
+    black_action(std::vector<node*> &pending) : pending(pending) {}
+
+    bool detail_perform(detail::node *node) override {
+        ++node->ref_count;
+        if(node->color != node_color::black) {
+            node->color = node_color::black;
+            pending.push_back(node);
+        }
+        return true;
+    }
+
+    std::vector<node*> &pending;
+};
+
+
+struct restore_action : action {
+    bool detail_perform(detail::node *node) override {
+        ++node->ref_count;
+        return true;
+    }
+};
+
+
+struct shade_action : action {
+    shade_action(heap &h) : h(h) {}
+
+    bool detail_perform(detail::node *node) override {
+        h.shade(node);
+        return true;
+    }
+
+    heap &h;
+};
+
+
+// transverses every node pushed onto the list after old_first, including the ones pushed while doing so
+void transverse_list(node_list &list, node *old_first, action &act) {
+    node *new_first = list.first;
+
+    while(old_first != new_first) {
         //debug_out("start transverse_list loop");
-        node *node = new_head;
+        node *node = new_first;
 
-        while(node != old_head) {
-            debug_not_head(node, nullptr);
+        while(node != old_first) {
             node->transverse(act);
-            node = node->next;
+            node = node->link;
         }
 
-        old_head = new_head;
-        new_head = head.next;
+        old_first = new_first;
+        new_first = list.first;
     }
 }
 
 
-void transverse_and_mark_reachable(anchor_node &n, action &act) {
-    node *old_head = temp_head.next;
-    n.detail_transverse(act);
+// wraps an action whose detail_perform returns true for nodes reached for the first time,
+// and keeps those nodes on a stack so they get transversed in turn
+struct reach_action : action {
+    reach_action(action &act) : act(act) {}
+
+    bool detail_perform(detail::node *node) override {
+        if(act.detail_perform(node))
+            pending.push_back(node);
+        return true;
+    }
+
+    void transverse_pending() {
+        while(!pending.empty()) {
+            node *n = pending.back();
+            pending.pop_back();
+            n->transverse(*this);
+        }
+    }
+
+    action &act;
+    std::vector<node*> pending;
+};
 
-	transverse_list(temp_head, old_head, act);
+
+// attributes every node it reaches to the root being profiled, unless another root reached it first,
+// in which case it's shared along with everything below it. so no node is transversed more than twice
+struct profile_action : action {
+    static constexpr std::size_t shared = std::numeric_limits<std::size_t>::max();
+
+    profile_action(heap_profile &result) : result(result), owner(0) {}
+
+    bool detail_perform(detail::node *node) override {
+        auto [it, added] = owners.emplace(node, owner);
+        if(!added && (it->second == owner || it->second == shared))
+            return true;
+
+        std::size_t size = node->get_size();
+        if(!added) {
+            --result.roots[it->second].retained_objects;
+            result.roots[it->second].retained_bytes -= size;
+            it->second = shared;
+        }
+
+        if(it->second == shared) {
+            ++result.shared_objects;
+            result.shared_bytes += size;
+        } else {
+            ++result.roots[owner].retained_objects;
+            result.roots[owner].retained_bytes += size;
+        }
+
+        pending.emplace_back(node, it->second);
+        return true;
+    }
+
+    void transverse_pending() {
+        while(!pending.empty()) {
+            node *n = pending.back().first;
+            owner = pending.back().second;
+            pending.pop_back();
+            n->transverse(*this);
+        }
+    }
+
+    heap_profile &result;
+    std::size_t owner;
+    std::unordered_map<node*, std::size_t> owners;
+    std::vector<std::pair<node*, std::size_t>> pending;
+};
+
+
+void transverse_and_mark_reachable(anchor_node &n, action &act) {
+    reach_action reach(act);
+    n.detail_transverse(reach);
+    reach.transverse_pending();
 }
 
 
 void transverse_and_mark_reachable(node *ptr, action &act) {
-    if(!ptr || !act.detail_perform(ptr))
+    if(!ptr)
+        return;
+
+    reach_action reach(act);
+    reach.detail_perform(ptr);
+    reach.transverse_pending();
+}
+
+
+void *large_allocate(std::size_t size) {
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+        throw std::bad_alloc();
+    return p;
+}
+
+
+void large_deallocate(void *p, std::size_t size) noexcept { ::munmap(p, size); }
+
+
+void node::free() {
+    heap &h = *current_heap;
+
+    if(debug && ref_count != 0)
+        throw std::logic_error("free: refcount is not 0!");
+
+    // a deferred ptr may still refer to it
+    if(h.is_deferring()) {
+        h.zct_push(this);
         return;
+    }
+
+    h.is_running = true;
+    node_list dying;
+    free_action(h, dying).detail_perform(this);
+    h.free_delayed(dying);
+
+    h.is_running = false;
+}
+
+
+}  // detail
+
+
+
+heap::~heap() {
+    heap *previous = std::exchange(detail::current_heap, this);
+
+    // whatever is left once every anchor into this heap is gone is garbage. if anchors outlive
+    // their heap, the pages stay allocated so they don't point into freed memory
+    if(anchor_head.next == &anchor_head && root_top == root_stack.get()) {
+        collect();
+        free_slice(std::numeric_limits<std::size_t>::max());
+    } else
+        pool.all_pages = nullptr;
+
+    // weak_ptrs that outlive their heap find their blocks expired
+    for(auto &entry : weak_blocks) {
+        entry.second->target = nullptr;
+        entry.second->owner = nullptr;
+    }
+
+    detail::current_heap = previous != this ? previous : &detail::default_heap;
+}
+
+
+void heap::collect() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    cancel_marking();
+
+    debug_out("collect: marking reachable nodes: " + std::to_string(object_count())
+            + ", anchors: " + std::to_string(anchor_count())
+            + ", memory used: " + std::to_string(memory_used));
+
+    // a full collection is an incremental cycle run to completion in one go
+    is_marking = true;
+    root_cursor = anchor_head.next;
+    if(mark_threads > 1 && node_count >= parallel_mark_min_nodes)
+        parallel_mark();
+    finish_marking();
     
-    node *old_head = temp_head.next;
-    ptr->transverse(act);
+    debug_out("collect: still reachable nodes: " + std::to_string(object_count())
+            + ", anchors: " + std::to_string(anchor_count())
+            + ", memory used: " + std::to_string(memory_used));
+
+    record_pause(start);
+}
+
+
+std::size_t heap::object_count() { return node_count; }
+
+
+std::size_t heap::anchor_count() {
+    std::size_t count = 0;
+    detail::anchor_node *next = anchor_head.next;
+
+    while(next != &anchor_head) {
+        ++count;
+        next = next->next;
+    }
 
-	transverse_list(temp_head, old_head, act);
+   return count; 
 }
 
 
-void transverse_and_mark_reachable(anchor_node &n) {
-    mark_reachable_action act;
-    transverse_and_mark_reachable(n, act);
+stats heap::get_stats() const {
+    stats result = counters;
+    result.bytes_allocated = bytes_allocated;
+    result.live_objects = node_count;
+    result.memory_used = memory_used;
+    result.memory_limit = memory_limit;
+    return result;
 }
 
 
-void transverse_and_mark_reachable(node *ptr) {
-    mark_reachable_action act;
-    transverse_and_mark_reachable(ptr, act);
+heap_profile heap::profile(const std::vector<detail::node*> &roots) {
+    heap_profile result;
+    result.roots.resize(roots.size());
+    detail::profile_action act(result);
+
+    for(std::size_t i = 0; i < roots.size(); ++i) {
+        if(!roots[i])
+            continue;
+
+        result.roots[i].shallow_bytes = roots[i]->get_size();
+        act.owner = i;
+        act.detail_perform(roots[i]);
+        act.transverse_pending();
+    }
+
+    return result;
 }
 
 
-void free_delayed() {
-    free_action act;
+void heap::set_memory_limit(std::size_t limit) {
+    memory_limit = limit;
+    set_incremental_start(incremental_start_percent);
+    update_pacing();
+    if(memory_used > memory_limit)
+        collect();
+}
 
-	node *old_head = &temp_head;
-    transverse_list(temp_head, old_head, act);
 
-	delete_list(temp_head, false);
-    temp_head.next = &temp_head;
-    temp_head.prev = &temp_head;
+void heap::set_allocation_budget(std::size_t bytes) {
+    budget_end = bytes < std::numeric_limits<std::size_t>::max() - bytes_allocated 
+        ? bytes_allocated + bytes : std::numeric_limits<std::size_t>::max();
 }
 
 
-void free_unreachable() {
+void heap::clear_allocation_budget() { budget_end = std::numeric_limits<std::size_t>::max(); }
+
+
+void heap::set_incremental(bool enabled) {
+    incremental_enabled = enabled;
+    if(!enabled)
+        cancel_marking();
+}
+
+
+void heap::set_incremental_start(std::size_t percent_of_limit) {
+    incremental_start_percent = percent_of_limit;
+    incremental_trigger = memory_limit / 100 * percent_of_limit;
+}
+
+
+void heap::set_slice_budget(std::size_t max_nodes, std::chrono::microseconds max_time) {
+    slice_nodes = max_nodes ? max_nodes : 1;
+    slice_time = max_time;
+}
+
+
+void heap::step() {
+    if(is_marking || (incremental_enabled && memory_used >= incremental_trigger))
+        incremental_step();
+}
+
+
+void heap::set_parallel_mark(std::size_t threads, std::size_t min_nodes) {
+    mark_threads = threads;
+    parallel_mark_min_nodes = min_nodes;
+    if(marker && marker->thread_count() != threads)
+        marker.reset();
+}
+
+
+void heap::set_pacing(bool enabled, std::size_t growth_percent, std::size_t min_bytes, std::size_t max_bytes) {
+    pacing = enabled;
+    pacing_growth_percent = growth_percent;
+    pacing_min = min_bytes;
+    pacing_max = max_bytes;
+    update_pacing();
+}
+
+
+// sets the trigger from the memory used right now, which after a collection is the live size
+void heap::update_pacing() {
+    if(!pacing) {
+        pacing_trigger = std::numeric_limits<std::size_t>::max();
+        return;
+    }
+
+    std::size_t ceiling = pacing_max ? std::min(pacing_max, memory_limit) : memory_limit;
+    std::size_t grown = memory_used + memory_used / 100 * pacing_growth_percent;
+    pacing_trigger = std::min(std::max(grown, pacing_min), ceiling);
+
+    // with no room left under the ceiling, collecting again on the next allocation would only thrash;
+    // the memory limit takes over until a collection frees enough
+    if(pacing_trigger <= memory_used)
+        pacing_trigger = std::numeric_limits<std::size_t>::max();
+}
+
+
+// objects under construction aren't reachable yet and are only tracked for the collections an
+// allocation retries, so a paced collection waits for the outermost allocation
+void heap::paced_collect() {
+    if(is_running || nested_create_count)
+        return;
+
+    debug_out("paced_collect: " + std::to_string(memory_used) + " reached " + std::to_string(pacing_trigger));
+    ++counters.paced_collections;
+    pacing_trigger = std::numeric_limits<std::size_t>::max();
+
+    if(incremental_enabled)
+        incremental_step();
+    else
+        collect();
+}
+
+
+void heap::set_cycle_collection(bool enabled, std::size_t max_candidates) {
+    cycle_collection = enabled;
+    cycle_candidate_limit = max_candidates ? max_candidates : 1;
+}
+
+
+// trial deletion (Bacon and Rajan). the references among everything reachable from the candidates
+// are taken off the counts; what is left with a count above 0 is referenced from outside, and so is
+// everything it reaches. the rest are cycles nothing else refers to
+void heap::collect_cycles() {
+    using namespace detail;
+
+    if(is_running || is_marking)
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<node*> gray;
+    std::size_t transversed = 0;
+
+    try {
+        pool.take_candidates([&](void *slot) {
+            node *n = static_cast<node*>(slot);
+            if(n->ref_count > 0 && n->color != node_color::gray) {
+                n->color = node_color::gray;
+                gray.push_back(n);
+            }
+        });
+    } catch(std::bad_alloc &) {
+        for(node *n : gray)
+            n->color = node_color::black;
+        return;
+    }
+
+    debug_out("collect_cycles: " + std::to_string(gray.size()) + " candidates");
+
+    // deferred ptrs count as references from outside for the duration
+    if(deferred_refs)
+        count_deferred(true);
+
+    std::vector<node*> pending;
+    try {
+        gray_action act(gray);
+        for(; transversed < gray.size(); ++transversed)
+            gray[transversed]->transverse(act);
+
+        pending.reserve(gray.size());
+    } catch(std::bad_alloc &) {
+        restore_action restore;
+        for(std::size_t i = 0; i < transversed; ++i)
+            gray[i]->transverse(restore);
+        for(node *n : gray)
+            n->color = node_color::black;
+        if(deferred_refs)
+            count_deferred(false);
+        return;
+    }
+
+    // a node in the zero count table has to outlive this, so it counts as referenced from outside too
+    black_action act(pending);
+    for(node *n : gray) {
+        if(n->color != node_color::gray || (n->ref_count == 0 && !n->link))
+            continue;
+
+        n->color = node_color::black;
+        pending.push_back(n);
+        while(!pending.empty()) {
+            node *next = pending.back();
+            pending.pop_back();
+            next->transverse(act);
+        }
+    }
+
+    // white nodes are only referenced by each other. their references to black nodes were never put back
+    node_list white;
+    for(node *n : gray) {
+        if(n->color == node_color::gray) {
+            n->color = node_color::white;
+            white.push(n);
+        }
+    }
+
+    std::size_t objects_before = node_count;
     is_running = true;
-    delete_list(active_head, true);
+    delete_list(white, false);
     is_running = false;
 
-    if(temp_head.next != &temp_head) {
-        //debug_out("still reachable nodes");
-        active_head.next = temp_head.next;
-        active_head.prev = temp_head.prev;
-        active_head.next->prev = &active_head;
-        active_head.prev->next = &active_head;
-        debug_not_head(active_head.next, nullptr);
-        debug_not_head(active_head.prev, nullptr);
+    if(deferred_refs)
+        count_deferred(false);
+
+    ++counters.cycle_collections;
+    counters.cycle_objects_freed += objects_before - node_count;
+    record_pause(start);
+
+    debug_out("collect_cycles: freed " + std::to_string(objects_before - node_count) + " objects");
+}
 
-        temp_head.next = &temp_head;
-        temp_head.prev = &temp_head;
-    } else {
-        //debug_out("no reachable nodes");
-        active_head.next = &active_head;
-        active_head.prev = &active_head;
+
+// makes room for an allocation of size bytes that would exceed the memory limit. the free queue
+// is emptied and cycles through the candidates are tried first, and the whole heap is only collected if that wasn't enough
+void heap::reclaim(std::size_t size) {
+    if(!free_queue.empty()) {
+        free_slice(std::numeric_limits<std::size_t>::max());
+        if(memory_used + size <= memory_limit)
+            return;
+    }
+    if(pool.candidate_count && !is_marking) {
+        collect_cycles();
+        if(memory_used + size <= memory_limit)
+            return;
     }
+    collect();
+}
 
-    //debug_out("free_unreachable: setting reachable = false");
-    reset_reachable_flag(active_head);
+
+// turning it off only stops gc::defer making new deferred ptrs; the ones alive stay valid
+void heap::set_deferred_rc(bool enabled, std::size_t max_pending) {
+    deferred_rc = enabled;
+    zct_limit = max_pending ? max_pending : 1;
 }
 
 
-void reset_reachable_flag(node &head) {
-    node *n = head.next;
-    while(n != &head) {
-        debug_not_head(n, nullptr);
-        if(debug && nested_create_count == 0 && !n->reachable)
-            debug_error("free_unreachable: n is not reachable");
-        n->reachable = false;
-        n = n->next;
+// a node put here while marking may still be reachable through a deferred ptr in an anchor that's
+// already been scanned, so it's kept for the rest of the cycle, as a counted ptr's node would be
+void heap::zct_push(detail::node *n) noexcept {
+    n->ref_count = 0;
+    if(is_marking)
+        shade(n);
+    if(n->link)
+        return;
+
+    n->link = zct;
+    zct = n;
+    ++zct_size;
+}
+
+
+// frees the nodes in the zero count table that are still at 0. either there are no deferred ptrs
+// or reconcile() has counted them all, so nothing else refers to those nodes
+void heap::release_zct() {
+    detail::node *n = std::exchange(zct, &detail::zct_end);
+    zct_size = 0;
+
+    detail::node_list dying;
+    bool was_reconciling = std::exchange(is_reconciling, true);
+    detail::free_action act(*this, dying);
+
+    while(n != &detail::zct_end) {
+        detail::node *next = n->link;
+        n->link = nullptr;
+        if(n->ref_count == 0)
+            act.detail_perform(n);
+        n = next;
     }
+
+    is_running = true;
+    free_delayed(dying);
+    is_running = false;
+    is_reconciling = was_reconciling;
+}
+
+
+// applies a count_deferred_action to every anchor and root, where all deferred ptrs live
+void heap::count_deferred(bool increment) {
+    detail::count_deferred_action act(*this, increment);
+
+    for(detail::anchor_node *n = anchor_head.next; n != &anchor_head; n = n->next)
+        n->detail_transverse(act);
+    for(detail::root_slot *slot = root_stack.get(); slot != root_top; ++slot)
+        if(slot->value)
+            slot->transverse(slot->value, act);
+
+    if(debug && act.found != deferred_refs) {
+        debug_error("count_deferred: found " + std::to_string(act.found) + " of "
+                + std::to_string(deferred_refs) + " deferred ptrs in anchors and roots");
+    }
+}
+
+
+void heap::reconcile() {
+    if(zct == &detail::zct_end || is_running)
+        return;
+
+    debug_out("reconcile: " + std::to_string(zct_size) + " nodes at 0, "
+            + std::to_string(deferred_refs) + " deferred ptrs");
+
+    is_reconciling = true;
+    if(deferred_refs)
+        count_deferred(true);
+    release_zct();
+    is_reconciling = false;
+
+    // the nodes only deferred ptrs refer to go back to 0, and into the table
+    if(deferred_refs)
+        count_deferred(false);
+}
+
+
+void heap::set_lazy_free(bool enabled, std::size_t slice_nodes) {
+    lazy_free = enabled;
+    lazy_free_slice = slice_nodes ? slice_nodes : 1;
+    if(!enabled)
+        free_slice(std::numeric_limits<std::size_t>::max());
+}
+
+
+bool heap::free_slice(std::size_t max_nodes) {
+    if(!free_queue.empty() && !is_running) {
+        is_running = true;
+        destroy_queued(max_nodes);
+        is_running = false;
+    }
+    return free_queue.empty();
+}
+
+
+void heap::free_delayed(detail::node_list &list) {
+    if(lazy_free) {
+        // whatever this slice doesn't get to waits for the next one
+        while(detail::node *n = list.first) {
+            list.first = n->link;
+            free_queue.push(n);
+        }
+        destroy_queued(lazy_free_slice);
+        return;
+    }
+
+    detail::free_action act(*this, list);
+    detail::transverse_list(list, nullptr, act);
+
+	delete_list(list, false);
+    list.first = nullptr;
 }
 
 
-void delete_list(node &head, bool dec_counts) {
-    dec_ref_action dec_action;
-    node *next = head.next;
+// the children of each node destroyed are pushed onto the queue in turn once their count drops to 0,
+// so a dead graph of any size is taken apart max_nodes nodes at a time
+void heap::destroy_queued(std::size_t max_nodes) {
+    detail::free_action act(*this, free_queue);
+    std::size_t destroyed = 0;
+
+    while(destroyed < max_nodes && !free_queue.empty()) {
+        detail::node *n = free_queue.first;
+        free_queue.first = n->link;
+        n->link = nullptr;
+
+        if(is_marking && detail::pool_is_marked(n)) {
+            // shaded since it was queued, so it may be on the gray stack
+            n->ref_count = 0;
+            zombies.push(n);
+            continue;
+        }
+
+        n->transverse(act);
+        n->before_destroy();
+        memory_used -= n->get_memory_used();
+        --node_count;
+        n->destroy();
+        pool.deallocate(n);
+        ++destroyed;
+    }
+
+    pool.release_empty_pages();
+    counters.lazy_objects_freed += destroyed;
+}
+
+
+void heap::free_unmarked() {
+    detail::node_list unreachable;
+
+    // a linear scan over the pages' bitmaps
+    pool.for_each_unmarked([&](void *slot) {
+        unreachable.push(static_cast<detail::node*>(slot));
+    });
+
+    is_running = true;
+    delete_list(unreachable, true);
+    is_running = false;
+
+    pool.clear_marks();
+}
+
+
+void heap::delete_list(detail::node_list &list, bool dec_counts) {
+    detail::dec_ref_action dec_action(*this);
+    detail::node *next = list.first;
 
     //debug_out("call before_destroy");
-    while(next != &head) {
-        debug_not_head(next, nullptr);
+    while(next) {
+        if(next->has_weak)
+            clear_weak(next);
         next->before_destroy();
         if(dec_counts)
             next->transverse(dec_action);
-        next = next->next;
+        next = next->link;
     }
 
-    next = head.next;
+    next = list.first;
 
     //debug_out("deleting list");
-    while(next != &head) {
-        debug_not_head(next, nullptr);
+    while(next) {
         if(debug && next->ref_count != 0)
             debug_error("delete_list ref_count = " + std::to_string(next->ref_count));
 
-        node *current = next;
-        next = next->next;
+        detail::node *current = next;
+        next = next->link;
         memory_used -= current->get_memory_used();
-        delete current;
+        --node_count;
+        current->destroy();
+        pool.deallocate(current);
+    }
+
+    pool.release_empty_pages();
+}
+
+
+detail::weak_block *heap::acquire_weak(detail::node *n) {
+    auto [it, inserted] = weak_blocks.try_emplace(n, nullptr);
+    if(inserted) {
+        try {
+            it->second = new detail::weak_block{n, this, 0};
+        } catch(...) {
+            weak_blocks.erase(it);
+            throw;
+        }
+        n->has_weak = true;
     }
+
+    ++it->second->weak_count;
+    return it->second;
 }
 
 
-void move_temp_to_active() {
-    if(temp_head.next != &temp_head) {
-        //debug_out("moving temp list to front of head");
-        temp_head.next->prev = &active_head;
-        temp_head.prev->next = active_head.next;
-        active_head.next->prev = temp_head.prev;
-        active_head.next = temp_head.next;
-        debug_not_head(active_head.next, nullptr);
-        debug_not_head(active_head.prev, nullptr);
+void heap::release_weak(detail::weak_block *block) noexcept {
+    if(--block->weak_count != 0)
+        return;
 
-        temp_head.next = &temp_head;
-        temp_head.prev = &temp_head;
+    if(block->target) {
+        block->target->has_weak = false;
+        block->owner->weak_blocks.erase(block->target);
     }
+    delete block;
 }
 
 
-bool node::mark_reachable() {
-    if(reachable)
-        return false;
+void heap::clear_weak(detail::node *n) noexcept {
+    n->has_weak = false;
 
-    reachable = true;
-    list_remove();
-    list_insert(temp_head);
-    return true;
+    auto it = weak_blocks.find(n);
+    if(it == weak_blocks.end())
+        return;
+
+    it->second->target = nullptr;
+    it->second->owner = nullptr;
+    weak_blocks.erase(it);
 }
 
 
-void node::free() {
-    is_running = true;
+void heap::grow_roots() {
+    std::size_t count = root_top - root_stack.get();
+    std::size_t capacity = count ? count * 2 : 64;
+    std::unique_ptr<detail::root_slot[]> bigger = std::make_unique<detail::root_slot[]>(capacity);
 
-    if(debug && ref_count != 0)
-        throw std::logic_error("free: refcount is not 0!");
-    free_action().detail_perform(this);
-    free_delayed();
+    std::copy(root_stack.get(), root_top, bigger.get());
+    root_stack = std::move(bigger);
+    root_top = root_stack.get() + count;
+    root_end = root_stack.get() + capacity;
+}
 
-    is_running = false;
+
+// a root was destroyed out of order, which happens when a return value isn't elided
+void heap::clear_root(void *value) noexcept {
+    for(detail::root_slot *slot = root_top; slot != root_stack.get(); --slot) {
+        if(slot[-1].value == value) {
+            slot[-1].value = nullptr;
+            return;
+        }
+    }
 }
 
 
-}  // detail
+void heap::shade(detail::node *n) noexcept {
+    if(!detail::pool_mark(n) || !n->has_children())
+        return;
+
+    try {
+        gray_stack.push_back(n);
+    } catch(std::bad_alloc &) {
+        // the node stays marked; finish_marking rescans marked nodes to find its children
+        gray_overflow = true;
+    }
+}
 
 
+// nodes are only pushed for which pool_is_live was checked, so a slot freed and reused since is
+// at worst kept alive for one more cycle
+void heap::shade_nested() {
+    for(detail::node *n : nested_nodes)
+        if(detail::pool_is_live(n))
+            shade(n);
+}
 
-void collect() {
-    detail::mark_reachable_action act;
-    detail::anchor_node *node = detail::anchor_head.next;
 
-    debug_out("collect: marking reachable nodes: " + std::to_string(object_count())
-            + ", anchors: " + std::to_string(anchor_count())
-            + ", memory used: " + std::to_string(detail::memory_used));
+// the root stack is only scanned here, at the end of a cycle. a value that left a root before that
+// went through a ptr reset or move, both of which shade it while marking
+void heap::shade_roots() {
+    detail::shade_action act(*this);
+    for(detail::root_slot *slot = root_stack.get(); slot != root_top; ++slot)
+        if(slot->value)
+            slot->transverse(slot->value, act);
+}
+
 
-    while(node != &detail::anchor_head) {
-        if(detail::node *n = node->detail_get_node())
-            detail::transverse_and_mark_reachable(n);
-        else
-            detail::transverse_and_mark_reachable(*node);
-        node = node->next;
+void heap::rescan_marked() {
+    detail::shade_action act(*this);
+    pool.for_each_marked([&](void *slot) {
+        static_cast<detail::node*>(slot)->transverse(act);
+    });
+}
+
+
+// returns true once there is no marking work left
+bool heap::mark_slice(std::size_t max_nodes, std::chrono::steady_clock::duration max_time) {
+    using namespace detail;
+    using clock = std::chrono::steady_clock;
+
+    shade_action act(*this);
+    clock::time_point start = clock::now();
+    std::size_t work = 0;
+
+    while(true) {
+        if(!gray_stack.empty()) {
+            node *n = gray_stack.back();
+            gray_stack.pop_back();
+            n->transverse(act);
+        } else if(root_cursor && root_cursor != &anchor_head) {
+            anchor_node *anchor = root_cursor;
+            root_cursor = anchor->next;
+
+            if(node *n = anchor->detail_get_node())
+                shade(n);
+            else
+                anchor->detail_transverse(act);
+        } else {
+            return true;
+        }
+
+        if(++work >= max_nodes || (work % 32 == 0 && clock::now() - start >= max_time))
+            return false;
     }
+}
 
-    //debug_out("collect: freeing unreachables");
-    detail::free_unreachable();
-    
-    debug_out("collect: still reachable nodes: " + std::to_string(object_count())
-            + ", anchors: " + std::to_string(anchor_count())
-            + ", memory used: " + std::to_string(detail::memory_used));
+
+void heap::release_zombies() {
+    detail::node_list dying = std::exchange(zombies, detail::node_list());
+
+    is_running = true;
+    free_delayed(dying);
+    is_running = false;
 }
 
 
-std::size_t object_count() {
-    if(debug && detail::nested_create_count == 0) {
-        if(detail::temp_head.next != &detail::temp_head)
-            debug_error("temp list is not empty");
-        if(detail::temp_head.prev != &detail::temp_head)
-            debug_error("temp_head.prev != head");
+void heap::finish_marking() {
+    debug_out("finish_marking: memory used: " + std::to_string(memory_used));
+
+    shade_nested();
+    shade_roots();
+
+    mark_slice(std::numeric_limits<std::size_t>::max(), std::chrono::steady_clock::duration::max());
+    while(gray_overflow) {
+        gray_overflow = false;
+        rescan_marked();
+        mark_slice(std::numeric_limits<std::size_t>::max(), std::chrono::steady_clock::duration::max());
     }
 
-    std::size_t count = 0;
-    detail::node *next = detail::active_head.next;
+    is_marking = false;
+    root_cursor = nullptr;
 
-    while(next != &detail::active_head) {
-        detail::debug_not_head(next, nullptr);
-        ++count;
-        next = next->next;
+    std::size_t objects_before = node_count;
+    std::size_t bytes_before = memory_used;
+
+    reconcile();
+    // a queued node is unmarked, but its children still have to be counted down
+    free_slice(std::numeric_limits<std::size_t>::max());
+    free_unmarked();
+    release_zombies();
+
+    ++counters.collections;
+    counters.last_objects_freed = objects_before - node_count;
+    counters.last_bytes_freed = bytes_before > memory_used ? bytes_before - memory_used : 0;
+    counters.total_objects_freed += counters.last_objects_freed;
+    counters.total_bytes_freed += counters.last_bytes_freed;
+    update_pacing();
+
+    debug_out("finish_marking: memory used after sweep: " + std::to_string(memory_used));
+}
+
+
+void heap::incremental_step() {
+    if(is_running)
+        return;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if(!is_marking) {
+        debug_out("incremental_step: starting a marking cycle at " + std::to_string(memory_used));
+        is_marking = true;
+        root_cursor = anchor_head.next;
     }
 
-   return count; 
+    if(mark_slice(slice_nodes, slice_time))
+        finish_marking();
+
+    ++counters.incremental_slices;
+    record_pause(start);
 }
 
 
-std::size_t anchor_count() {
-    std::size_t count = 0;
-    detail::anchor_node *next = detail::anchor_head.next;
+// marks from every anchor at once on the marker's threads. anything it can't do (it couldn't get
+// its threads or its root list) is left to the serial marking in finish_marking
+void heap::parallel_mark() {
+    std::vector<detail::anchor_node*> roots;
 
-    while(next != &detail::anchor_head) {
-        ++count;
-        next = next->next;
+    try {
+        if(!marker)
+            marker = std::make_unique<detail::parallel_marker>(mark_threads);
+
+        for(detail::anchor_node *n = anchor_head.next; n != &anchor_head; n = n->next)
+            roots.push_back(n);
+    } catch(std::exception &e) {
+        debug_out(std::string("parallel_mark: falling back to a serial mark: ") + e.what());
+        return;
     }
 
-   return count; 
+    debug_out("parallel_mark: " + std::to_string(roots.size()) + " anchors on "
+            + std::to_string(marker->thread_count()) + " threads");
+
+    shade_nested();
+
+    if(!marker->mark(roots, gray_stack))
+        gray_overflow = true;
+    root_cursor = &anchor_head;
 }
 
 
-std::size_t get_memory_used() { return detail::memory_used; }
+void heap::record_pause(std::chrono::steady_clock::time_point start) {
+    std::chrono::nanoseconds pause = std::chrono::steady_clock::now() - start;
+    counters.last_pause = pause;
+    counters.total_pause += pause;
+    counters.max_pause = std::max(counters.max_pause, pause);
+}
 
 
-std::size_t get_memory_limit() { return detail::memory_limit; }
+void heap::cancel_marking() {
+    if(!is_marking)
+        return;
 
+    debug_out("cancel_marking");
+    is_marking = false;
+    root_cursor = nullptr;
+    gray_stack.clear();
+    gray_overflow = false;
+    pool.clear_marks();
 
-void set_memory_limit(std::size_t limit) {
-    detail::memory_limit = limit;
-    if(detail::memory_used > detail::memory_limit)
-        collect();
+    release_zombies();
+    update_pacing();
+}
+
+
+
+heap &get_current_heap() noexcept { return *detail::current_heap; }
+
+
+heap *set_current_heap(heap &h) noexcept { return std::exchange(detail::current_heap, &h); }
+
+
+void collect() { detail::current_heap->collect(); }
+
+
+std::size_t object_count() { return detail::current_heap->object_count(); }
+
+
+std::size_t anchor_count() { return detail::current_heap->anchor_count(); }
+
+
+stats get_stats() { return detail::current_heap->get_stats(); }
+
+
+std::size_t get_memory_used() { return detail::current_heap->get_memory_used(); }
+
+
+std::size_t get_memory_limit() { return detail::current_heap->get_memory_limit(); }
+
+
+void set_memory_limit(std::size_t limit) { detail::current_heap->set_memory_limit(limit); }
+
+
+void set_allocation_budget(std::size_t bytes) { detail::current_heap->set_allocation_budget(bytes); }
+
+
+void clear_allocation_budget() { detail::current_heap->clear_allocation_budget(); }
+
+
+std::size_t get_bytes_allocated() { return detail::current_heap->get_bytes_allocated(); }
+
+
+void set_incremental(bool enabled) { detail::current_heap->set_incremental(enabled); }
+
+
+bool is_incremental() { return detail::current_heap->is_incremental(); }
+
+
+void set_incremental_start(std::size_t percent_of_limit) { detail::current_heap->set_incremental_start(percent_of_limit); }
+
+
+void set_slice_budget(std::size_t max_nodes, std::chrono::microseconds max_time) {
+    detail::current_heap->set_slice_budget(max_nodes, max_time);
+}
+
+
+void step() { detail::current_heap->step(); }
+
+
+void set_parallel_mark(std::size_t threads, std::size_t min_nodes) {
+    detail::current_heap->set_parallel_mark(threads, min_nodes);
+}
+
+
+void set_pacing(bool enabled, std::size_t growth_percent, std::size_t min_bytes, std::size_t max_bytes) {
+    detail::current_heap->set_pacing(enabled, growth_percent, min_bytes, max_bytes);
+}
+
+
+void set_cycle_collection(bool enabled, std::size_t max_candidates) {
+    detail::current_heap->set_cycle_collection(enabled, max_candidates);
+}
+
+
+void collect_cycles() { detail::current_heap->collect_cycles(); }
+
+
+void set_deferred_rc(bool enabled, std::size_t max_pending) {
+    detail::current_heap->set_deferred_rc(enabled, max_pending);
+}
+
+
+void set_lazy_free(bool enabled, std::size_t slice_nodes) { detail::current_heap->set_lazy_free(enabled, slice_nodes); }
+
+
+bool free_slice() {
+    heap &h = *detail::current_heap;
+    return h.free_slice(h.lazy_free_slice);
 }
 
 
@@ -0,0 +1,245 @@
+#include "gc_marker.hpp"
+#include "gc.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+
+namespace gc {
+
+namespace detail {
+
+
+constexpr std::size_t root_chunk = 64;
+constexpr std::size_t share_threshold = 64;
+
+
+struct parallel_marker::mark_action : action {
+    mark_action(parallel_marker &marker, worker &w) : marker(marker), w(w) {}
+
+    bool detail_perform(detail::node *node) override {
+        if(pool_mark_atomic(node) && node->has_children()) {
+            try {
+                w.local.push_back(node);
+            } catch(std::bad_alloc &) {
+                // the node stays marked; the heap rescans marked nodes to find its children
+                marker.overflow = true;
+            }
+        }
+        return true;
+    }
+
+    parallel_marker &marker;
+    worker &w;
+};
+
+
+parallel_marker::parallel_marker(std::size_t thread_count) {
+    for(std::size_t i = 0; i < std::max<std::size_t>(thread_count, 1); ++i)
+        workers.push_back(std::make_unique<worker>());
+
+    try {
+        for(std::size_t i = 1; i < workers.size(); ++i)
+            threads.emplace_back(&parallel_marker::run, this, i);
+    } catch(...) {
+        stop();
+        throw;
+    }
+}
+
+
+parallel_marker::~parallel_marker() { stop(); }
+
+
+void parallel_marker::stop() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for(std::thread &t : threads)
+        t.join();
+    threads.clear();
+}
+
+
+bool parallel_marker::mark(const std::vector<anchor_node*> &root_list, std::vector<node*> &gray) {
+    roots = &root_list;
+    next_root = 0;
+    idle = 0;
+    overflow = false;
+    workers[0]->local.swap(gray);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        ++generation;
+        finished = 0;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return finished == threads.size(); });
+
+    gray.clear();
+    workers[0]->local.swap(gray);
+    roots = nullptr;
+    return !overflow;
+}
+
+
+void parallel_marker::run(std::size_t index) {
+    std::size_t seen = 0;
+
+    while(true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+        }
+
+        drain(index);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            ++finished;
+        }
+        done.notify_one();
+    }
+}
+
+
+void parallel_marker::drain(std::size_t index) {
+    worker &w = *workers[index];
+    mark_action act(*this, w);
+
+    while(true) {
+        if(!w.local.empty()) {
+            node *n = w.local.back();
+            w.local.pop_back();
+            n->transverse(act);
+
+            if(w.local.size() > share_threshold && w.shared_size == 0)
+                share(w);
+            continue;
+        }
+
+        if(take_roots(w) || take_shared(w) || steal(index))
+            continue;
+
+        // nothing left here. marking is over once every worker is idle at the same time;
+        // a worker only goes idle with its own deque empty, so no work can hide behind an idle worker
+        ++idle;
+        while(true) {
+            if(idle == workers.size())
+                return;
+            if(has_work()) {
+                --idle;
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+
+bool parallel_marker::take_roots(worker &w) {
+    std::size_t begin = next_root.fetch_add(root_chunk);
+    if(begin >= roots->size())
+        return false;
+
+    mark_action act(*this, w);
+    std::size_t end = std::min(begin + root_chunk, roots->size());
+
+    for(std::size_t i = begin; i < end; ++i) {
+        anchor_node *anchor = (*roots)[i];
+        if(node *n = anchor->detail_get_node())
+            act.detail_perform(n);
+        else
+            anchor->detail_transverse(act);
+    }
+    return true;
+}
+
+
+bool parallel_marker::take_shared(worker &w) {
+    if(w.shared_size == 0)
+        return false;
+
+    std::lock_guard<std::mutex> guard(w.lock);
+    if(w.shared.empty())
+        return false;
+
+    try {
+        w.local.insert(w.local.end(), w.shared.begin(), w.shared.end());
+    } catch(std::bad_alloc &) {
+        // dropping marked nodes is fine as long as the heap is told to rescan
+        overflow = true;
+    }
+    w.shared.clear();
+    w.shared_size = 0;
+    return true;
+}
+
+
+bool parallel_marker::steal(std::size_t index) {
+    worker &w = *workers[index];
+
+    for(std::size_t i = 1; i < workers.size(); ++i) {
+        worker &victim = *workers[(index + i) % workers.size()];
+        if(victim.shared_size == 0)
+            continue;
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+        std::size_t count = (victim.shared.size() + 1) / 2;
+        if(count == 0)
+            continue;
+
+        try {
+            w.local.insert(w.local.end(), victim.shared.begin(), victim.shared.begin() + count);
+        } catch(std::bad_alloc &) {
+            overflow = true;
+        }
+        victim.shared.erase(victim.shared.begin(), victim.shared.begin() + count);
+        victim.shared_size = victim.shared.size();
+        return true;
+    }
+    return false;
+}
+
+
+// hands the older half of the private stack to the deque. the oldest entries are the closest
+// to the roots, so they tend to lead to the largest unexplored subgraphs
+void parallel_marker::share(worker &w) {
+    std::size_t count = w.local.size() / 2;
+
+    std::lock_guard<std::mutex> guard(w.lock);
+    try {
+        w.shared.insert(w.shared.end(), w.local.begin(), w.local.begin() + count);
+    } catch(std::bad_alloc &) {
+        return;
+    }
+    w.local.erase(w.local.begin(), w.local.begin() + count);
+    w.shared_size = w.shared.size();
+}
+
+
+bool parallel_marker::has_work() const {
+    if(next_root < roots->size())
+        return true;
+
+    return std::any_of(workers.begin(), workers.end(), [](const std::unique_ptr<worker> &w) {
+        return w->shared_size != 0;
+    });
+}
+
+
+}  // namespace detail
+
+}  // namespace gc
+
@@ -0,0 +1,319 @@
+#include "gc_pool.hpp"
+#include "debug.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+
+
+namespace gc {
+
+namespace detail {
+
+
+// pages are mapped straight from the os, so a page that's released doesn't linger in malloc's heap.
+// the mapping is made a page bigger than needed and trimmed to get the alignment
+void *map_page(std::size_t page_bytes) {
+    std::size_t size = page_bytes + pool_page_size;
+    char *mem = static_cast<char*>(::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(mem == MAP_FAILED)
+        throw std::bad_alloc();
+
+    char *page = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(mem) + pool_page_size - 1) & ~(pool_page_size - 1));
+    if(page != mem)
+        ::munmap(mem, page - mem);
+    if(page + page_bytes != mem + size)
+        ::munmap(page + page_bytes, mem + size - (page + page_bytes));
+    return page;
+}
+
+
+pool::~pool() {
+    while(all_pages)
+        free_page(all_pages);
+}
+
+
+void page_link(pool_page *page, pool_page **list) {
+    page->list = list;
+    page->prev_page = nullptr;
+    page->next_page = *list;
+    if(*list)
+        (*list)->prev_page = page;
+    *list = page;
+}
+
+
+void page_unlink(pool_page *page) {
+    if(page->prev_page)
+        page->prev_page->next_page = page->next_page;
+    else
+        *page->list = page->next_page;
+    if(page->next_page)
+        page->next_page->prev_page = page->prev_page;
+    page->list = nullptr;
+}
+
+
+pool_page *pool::new_page(std::size_t page_bytes, std::size_t slot_size, pool_class *owner) {
+    void *mem = map_page(page_bytes);
+    pool_page *page = new (mem) pool_page();
+    page->free_list = nullptr;
+    page->slots = static_cast<char*>(mem) + pool_header_size;
+    page->bump = page->slots;
+    page->slot_size = slot_size;
+    page->used = 0;
+    page->capacity = (page_bytes - pool_header_size) / slot_size;
+    page->owner = owner;
+    page->list = nullptr;
+    std::fill(std::begin(page->live_bits), std::end(page->live_bits), 0);
+    std::fill(std::begin(page->mark_bits), std::end(page->mark_bits), 0);
+    std::fill(std::begin(page->candidate_bits), std::end(page->candidate_bits), 0);
+
+    page->prev_all = nullptr;
+    page->next_all = all_pages;
+    if(all_pages)
+        all_pages->prev_all = page;
+    all_pages = page;
+    return page;
+}
+
+
+void pool::free_page(pool_page *page) {
+    if(page->prev_all)
+        page->prev_all->next_all = page->next_all;
+    else
+        all_pages = page->next_all;
+    if(page->next_all)
+        page->next_all->prev_all = page->prev_all;
+
+    std::size_t page_bytes = page->owner ? pool_page_size : page->slot_size;
+    page->~pool_page();
+    ::munmap(page, page_bytes);
+}
+
+
+void *pool::large_allocate(std::size_t size) {
+    std::size_t page_bytes = pool_large_size(size);
+    pool_page *page = new_page(page_bytes, page_bytes, nullptr);
+    page->capacity = 1;     // its slot is the whole page, header and all, so the division made it 0
+    page->used = 1;
+    ++large_page_count;
+    return page->bump;
+}
+
+void *pool::allocate(std::size_t size) {
+    if(!is_pooled_size(size))
+        return large_allocate(size);
+
+    pool_class &cls = classes[pool_class_index(size)];
+    pool_page *page = cls.partial;
+
+    if(!page) {
+        if(cls.empty) {
+            page = cls.empty;
+            page_unlink(page);
+        } else {
+            page = new_page(pool_page_size, pool_allocation_size(size), &cls);
+            ++cls.page_count;
+        }
+        page_link(page, &cls.partial);
+    }
+
+    void *slot;
+    if(page->free_list) {
+        slot = page->free_list;
+        page->free_list = *static_cast<void**>(slot);
+    } else {
+        slot = page->bump;
+        page->bump += page->slot_size;
+    }
+
+    if(++page->used == page->capacity)
+        page_unlink(page);
+    return slot;
+}
+
+
+void pool::deallocate(void *p) {
+    pool_page *page = pool_page_of(p);
+    std::size_t index = pool_slot_index(page, p);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    page->live_bits[index / 64] &= ~bit;
+    page->mark_bits[index / 64] &= ~bit;
+    if(page->candidate_bits[index / 64] & bit) {
+        page->candidate_bits[index / 64] &= ~bit;
+        --candidate_count;
+    }
+
+    if(!page->owner) {
+        --large_page_count;
+        free_page(page);
+        return;
+    }
+
+    if(debug && page->used == 0)
+        throw std::logic_error("pool_deallocate: page has no live slots");
+
+    if(page->used-- == page->capacity)
+        page_link(page, &page->owner->partial);
+
+    *static_cast<void**>(p) = page->free_list;
+    page->free_list = p;
+
+    if(page->used == 0) {
+        page_unlink(page);
+        page->free_list = nullptr;
+        page->bump = page->slots;
+        page_link(page, &page->owner->empty);
+    }
+}
+
+
+void pool::release_empty_pages() {
+    for(pool_class &cls : classes) {
+        // keep a single spare page so a class that allocates and frees in a loop doesn't thrash
+        pool_page *keep = cls.partial ? nullptr : cls.empty;
+        pool_page *page = cls.empty;
+
+        while(page) {
+            pool_page *next = page->next_page;
+            if(page != keep) {
+                page_unlink(page);
+                free_page(page);
+                --cls.page_count;
+            }
+            page = next;
+        }
+    }
+}
+
+
+void pool::clear_marks() {
+    for(pool_page *page = all_pages; page; page = page->next_all)
+        std::fill(page->mark_bits, page->mark_bits + (page->capacity + 63) / 64, 0);
+}
+
+
+namespace {
+
+
+struct central_blocks {
+    // the chunks are only freed once every block carved out of them is back in the central bins.
+    // a block still out somewhere, in a thread that hasn't exited or a heap destroyed after this,
+    // keeps all of them
+    ~central_blocks() {
+        for(std::size_t i = 0; i < block_bin_count; ++i) {
+            if(bins[i].count != carved[i])
+                return;
+        }
+        for(void *p : chunks)
+            ::operator delete(p);
+    }
+
+    std::mutex lock;
+    block_bin bins[block_bin_count] = {};
+    std::size_t carved[block_bin_count] = {};
+    std::vector<void*> chunks;
+    char *chunk = nullptr;
+    char *chunk_end = nullptr;
+};
+
+central_blocks central;
+
+
+// gives the thread's blocks back when it exits. it's only touched on a refill, which
+// keeps the fast path down to a plain thread_local without a destructor
+struct block_cache_owner {
+    ~block_cache_owner() {
+        for(std::size_t i = 0; i < block_bin_count; ++i)
+            drain_block_bin(i, block_cache[i].count);
+    }
+};
+
+
+}  // namespace
+
+
+void *refill_block_bin(std::size_t index) {
+    static thread_local block_cache_owner owner;
+    (void)owner;
+
+    std::size_t size = block_bin_size(index);
+    block_bin &bin = block_cache[index];
+    std::lock_guard<std::mutex> guard(central.lock);
+    block_bin &from = central.bins[index];
+
+    for(std::size_t i = 0; i < block_batch_count(index); ++i) {
+        void *p;
+        if(from.first) {
+            p = from.first;
+            from.first = *static_cast<void**>(p);
+            --from.count;
+        } else {
+            if(static_cast<std::size_t>(central.chunk_end - central.chunk) < size) {
+                // what's left of the old chunk is too small for this bin, so it's dropped
+                if(i > 0)
+                    break;
+                central.chunks.reserve(central.chunks.size() + 1);
+                central.chunk = static_cast<char*>(::operator new(block_chunk_size));
+                central.chunk_end = central.chunk + block_chunk_size;
+                central.chunks.push_back(central.chunk);
+            }
+            p = central.chunk;
+            central.chunk += size;
+            ++central.carved[index];
+        }
+
+        *static_cast<void**>(p) = bin.first;
+        bin.first = p;
+        ++bin.count;
+    }
+
+    void *p = bin.first;
+    bin.first = *static_cast<void**>(p);
+    --bin.count;
+    return p;
+}
+
+
+void drain_block_bin(std::size_t index, std::size_t count) noexcept {
+    block_bin &bin = block_cache[index];
+    if(count == 0 || !bin.first)
+        return;
+
+    void *first = bin.first;
+    void *last = first;
+    std::size_t taken = 1;
+    while(taken < count && *static_cast<void**>(last)) {
+        last = *static_cast<void**>(last);
+        ++taken;
+    }
+    bin.first = *static_cast<void**>(last);
+    bin.count -= taken;
+
+    std::lock_guard<std::mutex> guard(central.lock);
+    block_bin &to = central.bins[index];
+    *static_cast<void**>(last) = to.first;
+    to.first = first;
+    to.count += taken;
+}
+
+
+std::size_t pool::page_count() const {
+    std::size_t count = large_page_count;
+    for(const pool_class &cls : classes)
+        count += cls.page_count;
+    return count;
+}
+
+
+}  // namespace detail
+
+}  // namespace gc
+
@@ -9,7 +9,6 @@
 #include "operation_type.hpp"
 #include "stack_util.hpp"
 #include "string_util.hpp"
-#include "variant_util.hpp"
 
 #include <cstddef>
 #include <ctime>
@@ -42,6 +41,10 @@ public:
         : mem(m), max_depth(max_call_depth), last_value(), operands(), parent_operand_count(0) {}
     
     std::string execute(std::shared_ptr<func_def> program);
+    void finish_run();
+
+    std::size_t allocation_budget = 0;
+    std::size_t max_retained_stack = 1024;
 
 private:
     void execute_op_code(program_state &state);
@@ -51,7 +54,8 @@ private:
     void param_add();
     void map_add();
     void call_func(program_state &state);
-    void execute_binary_op(op_code code);
+    void execute_binary_op(program_state &state, op_code code);
+    static bool next_is_semicolon(program_state &state);
     void execute_unary_op(op_code code);
     void execute_control_statement(memory_buffer<debug> &buffer, op_code code);
     void execute_short_circuit(memory_buffer<debug> &buffer, op_code code, bool jump_value);
@@ -72,9 +76,27 @@ interpreter::interpreter(memory *m, std::size_t max_call_depth)
 interpreter::~interpreter() {}
 
 std::string interpreter::execute(std::shared_ptr<func_def> program) {
-    return impl->execute(std::move(program));
+    if(impl->allocation_budget)
+        gc::set_allocation_budget(impl->allocation_budget);
+
+    try {
+        std::string result = impl->execute(std::move(program));
+        impl->finish_run();
+        return result;
+    } catch(...) {
+        impl->finish_run();
+        throw;
+    }
 }
 
+void interpreter::set_allocation_budget(std::size_t bytes) { impl->allocation_budget = bytes; }
+
+std::size_t interpreter::get_allocation_budget() const { return impl->allocation_budget; }
+
+void interpreter::set_max_retained_stack(std::size_t entries) { impl->max_retained_stack = entries; }
+
+std::size_t interpreter::get_max_retained_stack() const { return impl->max_retained_stack; }
+
 
 void interpreter_impl::execute_control_statement(memory_buffer<debug> &buffer, op_code code) {
     if(debug && operands->size() <= parent_operand_count) {
@@ -112,7 +134,7 @@ void interpreter_impl::execute_coalesce(memory_buffer<debug> &buffer, op_code co
 
     std::uint32_t jump_pos = *buffer.read<std::uint32_t>();
 
-    if(!std::holds_alternative<std::monostate>(operands->back().value()))
+    if(!operands->back().visit([](auto &&v) { return std::is_same_v<std::decay_t<decltype(v)>, std::monostate>; }))
         buffer.seek_abs(jump_pos);
     else
         operands->pop_back();
@@ -169,6 +191,20 @@ std::string interpreter_impl::execute(std::shared_ptr<func_def> program) {
 }
 
 
+// a run that threw leaves its stacks as they were, so they're emptied here either way
+void interpreter_impl::finish_run() {
+    if(allocation_budget)
+        gc::clear_allocation_budget();
+
+    if(max_retained_stack) {
+        operands->clear();
+        mem->clear_stack();
+        shrink_stack(*operands, max_retained_stack);
+        mem->shrink_stacks(max_retained_stack);
+    }
+}
+
+
 void interpreter_impl::execute_op_code(program_state &state) {
     memory_buffer<debug> &buffer = *state.buffer;
 
@@ -176,6 +212,7 @@ void interpreter_impl::execute_op_code(program_state &state) {
         if(std::time(nullptr) - state.start_time > 30)
             throw std::runtime_error("Execution terminated after 30 seconds");
         state.loops = loop_count;
+        gc::step();
     }
 
     op_code code = *buffer.read<op_code>();
@@ -192,10 +229,10 @@ void interpreter_impl::execute_op_code(program_state &state) {
             operands->pop();
         break;*/
     case op_code::global_var:
-        operands->push_back(object(mem->get_or_add_global(std::string(buffer.read_str()))));
+        operands->push_back(object(gc::defer(mem->get_or_add_global(std::string(buffer.read_str())))));
         break;
     case op_code::local_var:
-        operands->push_back(object(mem->get_local_var(*buffer.read<std::uint8_t>())));
+        operands->push_back(object(gc::defer(mem->get_local_var(*buffer.read<std::uint8_t>()))));
         break;
     case op_code::int_lit:
         operands->push_back(object(*buffer.read<std::int64_t>()));
@@ -252,7 +289,7 @@ void interpreter_impl::execute_op_code(program_state &state) {
             throw std::logic_error("Unexpected "s + lookup_operation(code).symbol + " in program");
 
         if(is_binary_op(code)) {
-            execute_binary_op(code);
+            execute_binary_op(state, code);
         } else {
             if(executor::unary_op(last_value, *operands, parent_operand_count, code))
                 buffer.seek_abs(state.code_size);
@@ -301,7 +338,7 @@ void interpreter_impl::array_add() {
         throw std::logic_error("execute array_add with " + std::to_string(operands->size() - parent_operand_count) + " operands");
 
     object &array = *(operands->end() - 2);
-    std::get<array_ref>(array.value())->push_back(operands->back());
+    array.get_if<gcvector<object>>()->push_back(operands->back());
     operands->pop_back();
 }
 
@@ -311,12 +348,9 @@ void interpreter_impl::param_add() {
         throw std::logic_error("execute param_add with " + std::to_string(operands->size() - parent_operand_count) + " operands");
 
     object &array = *(operands->end() - 2);
-    object::type param = to_variant<object::type>(operands->back().value());
-
-    gc::anchor_ptr<object> param_lvalue = make_lvalue(std::move(param));
-    //gc::anchor_ptr<object> param_anchor = param_lvalue;
+    gc::root<var_ref> param_lvalue = gc::make_ptr<object>(operands->back().take_value());
 
-    std::get<array_ref>(array.value())->push_back(object(param_lvalue));
+    array.get_if<gcvector<object>>()->push_back(object(*param_lvalue));
     operands->pop_back();
 }
 
@@ -328,7 +362,7 @@ void interpreter_impl::map_add() {
     object &value = operands->back();
     object &key = *(operands->end() - 2);
     object &map = *(operands->end() - 3);
-    std::get<map_ref>(map.value())->try_emplace(key.to_string(), value);
+    map.get_if<gcmap>()->try_emplace(key.to_string_ref(), value);
     operands->pop_back();
     operands->pop_back();
 }
@@ -341,7 +375,7 @@ void interpreter_impl::call_func(program_state &state) {
     if(mem->call_depth() > max_depth)
         throw std::runtime_error("stack overflow: max call depth of " + std::to_string(max_depth));
 
-    array_ref &params = std::get<array_ref>(operands->back().get());
+    array_ref params = std::get<array_ref>(operands->back().get());
     object::value_type func_obj = (operands->end() - 2)->value();
     func_ref *func = std::get_if<func_ref>(&func_obj);
     if(!func)
@@ -356,45 +390,54 @@ void interpreter_impl::call_func(program_state &state) {
 }
 
 
-void interpreter_impl::execute_binary_op(op_code code) {
+bool interpreter_impl::next_is_semicolon(program_state &state) {
+    std::size_t pos = state.buffer->position();
+    return pos < state.code_size && static_cast<op_code>(state.buffer->buffer()[pos]) == op_code::semicolon;
+}
+
+
+void interpreter_impl::execute_binary_op(program_state &state, op_code code) {
     if(debug && operands->size() < parent_operand_count + 2) {
         throw std::logic_error("execute_binary_op with " + std::to_string(operands->size() - parent_operand_count) 
                 + " operands. op_code: " + lookup_operation(code).symbol);
     }
 
     bool is_assign = is_binary_assignment(code);
-    // TODO: only use anchors when the op is something that allocates memory?
-    gc::anchor<object> right = pop(*operands);
-    gc::anchor<object> left = is_assign ? gc::anchor<object>(operands->back()) : pop(*operands);
+    gc::root<object> right = pop(*operands);
+    object &left = operands->back();    // replaced by the result, unless it's assigned to
     object result;
 
     if(is_assign && code != op_code::assign) {
         code = static_cast<op_code>(static_cast<int>(code) - assign_ops_offset);
     }
 
+    // s += x in a loop would copy s every time round otherwise. last_value may still hold s's old
+    // value, which is only safe to change when the ; ending the statement comes next and replaces it
+    static const object none;
+    const object &replaced = next_is_semicolon(state) ? *last_value : none;   // a copy would add a reference
+    if(is_assign && code == op_code::add && executor::append_assign(left, *right, replaced))
+        return;
+
     if(code == op_code::assign)
-        result = *right;
+        result = right->take_value();
     else if(code == op_code::index)
-        result = executor::index_op(mem, *left, *right);
+        result = executor::index_op(mem, left, *right);
     else if(is_binary_comp(code))
-        result = object::type(static_cast<std::int64_t>(executor::binary_comp(code, *left, *right)));
+        result = object::type(static_cast<std::int64_t>(executor::binary_comp(code, left, *right)));
     else if(is_binary_int_op(code))
-        result = executor::binary_int_op(code, *left, *right);
+        result = executor::binary_int_op(code, left, *right);
     else if(is_binary_arithmetic(code))
-        result = executor::binary_arithmetic(code, *left, *right);
+        result = executor::binary_arithmetic(code, left, *right);
     else
         throw std::logic_error("currently unspported binary op: "s + lookup_operation(code).symbol);
 
     if(is_assign) {
-        if(var_ref *var = std::get_if<var_ref>(&left->get())) {
-            **var = to_variant<object::type>(result.value());
-        } else if(lvalue_ref *lvalue = std::get_if<lvalue_ref>(&left->get())) {
-            **lvalue = to_variant<object::type>(result.value()); 
-        } else {
+        object *target = left.target();
+        if(!target)
             throw std::runtime_error("left of "s + lookup_operation(code).symbol + " is not assignable");
-        }
+        *target = result.take_value();
     } else {
-        operands->push_back(std::move(result));
+        left = std::move(result);
     }
 }
 
@@ -26,6 +26,7 @@ public:
     void write(std::string_view message);
 
     irc_message read();
+    bool has_input();
     
 private:
     void auth();
@@ -101,6 +102,8 @@ void irc_client::write(std::string_view message) { impl->write(message); }
 
 irc_message irc_client::read() { return impl->read(); }
 
+bool irc_client::has_input() { return impl->has_input(); }
+
 
 
 void irc_client_impl::login() {
@@ -181,6 +184,13 @@ irc_message irc_client_impl::read() {
 }
     
 
+bool irc_client_impl::has_input() {
+    boost::system::error_code error;
+    // an error is reported by the next read
+    return sock_buf.size() > 0 || sock.available(error) > 0 || error;
+}
+
+
 void irc_client_impl::auth() {
     bool sent_nick = false;
     bool sent_user = false;
@@ -12,7 +12,9 @@
 #include <cstdint>
 #include <ctime>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <utility>
@@ -37,6 +39,87 @@ std::string to_hex(const gcvector<std::uint8_t> &bytes) {
 }
 
 
+std::string gc_stats_summary() {
+    using std::to_string;
+    using micros = std::chrono::duration<double, std::micro>;
+
+    gc::stats s = gc::get_stats();
+    double avg_pause = s.collections + s.incremental_slices 
+        ? micros(s.total_pause).count() / (s.collections + s.incremental_slices) : 0;
+
+    return "collections: " + to_string(s.collections) 
+        + ", incremental slices: " + to_string(s.incremental_slices)
+        + ", pause us (avg/max/last): " + to_string(static_cast<long>(avg_pause)) 
+        + "/" + to_string(static_cast<long>(micros(s.max_pause).count()))
+        + "/" + to_string(static_cast<long>(micros(s.last_pause).count()))
+        + ", freed last: " + to_string(s.last_objects_freed) + " objects " + to_string(s.last_bytes_freed) + " bytes"
+        + ", freed total: " + to_string(s.total_objects_freed) + " objects " + to_string(s.total_bytes_freed) + " bytes"
+        + ", limit retries: " + to_string(s.limit_retries)
+        + ", bad_alloc retries: " + to_string(s.bad_alloc_retries)
+        + ", paced: " + to_string(s.paced_collections)
+        + ", cycle collections: " + to_string(s.cycle_collections) + " freeing " + to_string(s.cycle_objects_freed) + " objects"
+        + ", freed lazily: " + to_string(s.lazy_objects_freed) + " objects"
+        + ", live objects: " + to_string(s.live_objects)
+        + ", memory: " + to_string(s.memory_used) + "/" + to_string(s.memory_limit);
+}
+
+
+// a size or count written in decimal digits alone. std::stoul would take "-5" as a huge number and
+// "5x" as 5; those throw std::invalid_argument instead, and a number too big std::out_of_range
+std::size_t parse_size(std::string_view str) {
+    std::string digits = trim(std::string(str));
+    if(digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos)
+        throw std::invalid_argument("not a number: " + digits);
+
+    unsigned long long value = std::stoull(digits);
+    if(value > std::numeric_limits<std::size_t>::max())
+        throw std::out_of_range("too large: " + digits);
+    return static_cast<std::size_t>(value);
+}
+
+
+// "!budget" shows the allocation budget of a single run, "!budget <bytes>" changes it (0 removes it)
+std::string allocation_budget(interpreter &i, std::string_view command) {
+    using std::to_string;
+
+    try {
+        if(command.size() > 8)
+            i.set_allocation_budget(parse_size(command.substr(8)));
+    } catch(std::exception &) {
+        return "usage: !budget <bytes>";
+    }
+
+    std::size_t budget = i.get_allocation_budget();
+    return "allocation budget per run: " + (budget ? to_string(budget) + " bytes" : "none"s);
+}
+
+
+// "!heap [count]" lists the globals that keep the most memory alive (5 of them by default)
+std::string heap_summary(memory &m, std::string_view command) {
+    using std::to_string;
+
+    std::size_t count = 5;
+    try {
+        if(command.size() > 6)
+            count = parse_size(command.substr(6));
+    } catch(std::exception &) {
+        return "usage: !heap <count>";
+    }
+
+    globals_profile profile = m.profile_globals();
+    std::string summary = "globals by retained size:";
+
+    for(std::size_t i = 0; i < count && i < profile.globals.size(); ++i) {
+        const global_size &g = profile.globals[i];
+        summary += " " + g.name + ": " + to_string(g.size.retained_bytes) + " bytes in " 
+            + to_string(g.size.retained_objects) + " objects (" + to_string(g.size.shallow_bytes) + " shallow),";
+    }
+
+    return summary + " shared: " + to_string(profile.shared_bytes) + " bytes in " 
+        + to_string(profile.shared_objects) + " objects, of " + to_string(profile.globals.size()) + " globals";
+}
+
+
 std::string run(compiler &c, interpreter &i, std::string_view code, bool persist) {
     try {
         tokenizer t(std::string(code.data(), code.size()));
@@ -47,17 +130,26 @@ std::string run(compiler &c, interpreter &i, std::string_view code, bool persist
 }
 
 
-void run_irc(settings &s, compiler &c, interpreter &i) {
+void run_irc(settings &s, memory &m, compiler &c, interpreter &i) {
     irc_client irc(s);
     irc.login();
 
     while(true) {
+        // garbage the last script left in the free queue is destroyed while no message is waiting
+        while(!irc.has_input() && !gc::free_slice()) {}
+
         irc_message msg = irc.read();
 
         if(msg.action() != "PRIVMSG")
             continue;
 
-        if(msg.is_admin_msg()) {
+        if(msg.is_admin_msg() && msg.message() == "!gcstats") {
+            irc.write("PRIVMSG "s + msg.sender_nick() + " :" + gc_stats_summary());
+        } else if(msg.is_admin_msg() && (msg.message() == "!budget" || starts_with(msg.message(), "!budget "))) {
+            irc.write("PRIVMSG "s + msg.sender_nick() + " :" + allocation_budget(i, msg.message()));
+        } else if(msg.is_admin_msg() && (msg.message() == "!heap" || starts_with(msg.message(), "!heap "))) {
+            irc.write("PRIVMSG "s + msg.sender_nick() + " :" + heap_summary(m, msg.message()));
+        } else if(msg.is_admin_msg()) {
             irc.write(msg.message());
             if(starts_with(msg.message(), "QUIT"))
                 return;
@@ -83,13 +175,53 @@ int main(int argc, char* argv[]) {
     std::string_view max_memory = setting.first("max_memory").value_or("100000000");
     gc::set_memory_limit(std::stoul(std::string(max_memory)));
 
+    std::string_view incremental = setting.first("gc_incremental").value_or("0");
+    gc::set_incremental(incremental != "0");
+
+    std::string_view incremental_start = setting.first("gc_incremental_start").value_or("75");
+    gc::set_incremental_start(std::stoul(std::string(incremental_start)));
+
+    std::string_view slice_nodes = setting.first("gc_slice_nodes").value_or("1000");
+    std::string_view slice_us = setting.first("gc_slice_us").value_or("1000");
+    gc::set_slice_budget(std::stoul(std::string(slice_nodes)), 
+            std::chrono::microseconds(std::stoul(std::string(slice_us))));
+
+    std::string_view mark_threads = setting.first("gc_mark_threads").value_or("1");
+    std::string_view parallel_min = setting.first("gc_parallel_mark_min_objects").value_or("100000");
+    gc::set_parallel_mark(std::stoul(std::string(mark_threads)), std::stoul(std::string(parallel_min)));
+
+    std::string_view run_budget = setting.first("max_allocation_per_run").value_or("0");
+    i.set_allocation_budget(parse_size(run_budget));
+
+    std::string_view retained_stack = setting.first("max_retained_stack").value_or("1024");
+    i.set_max_retained_stack(std::stoul(std::string(retained_stack)));
+
+    std::string_view pacing = setting.first("gc_pacing").value_or("0");
+    std::string_view growth = setting.first("gc_pacing_growth_percent").value_or("100");
+    std::string_view pacing_min = setting.first("gc_pacing_min").value_or("4000000");
+    std::string_view pacing_max = setting.first("gc_pacing_max").value_or("0");
+    gc::set_pacing(pacing != "0", std::stoul(std::string(growth)), 
+            std::stoul(std::string(pacing_min)), std::stoul(std::string(pacing_max)));
+
+    std::string_view cycles = setting.first("gc_cycle_collection").value_or("0");
+    std::string_view cycle_candidates = setting.first("gc_cycle_candidates").value_or("10000");
+    gc::set_cycle_collection(cycles != "0", std::stoul(std::string(cycle_candidates)));
+
+    std::string_view deferred_rc = setting.first("gc_deferred_rc").value_or("0");
+    std::string_view deferred_max = setting.first("gc_deferred_max_pending").value_or("10000");
+    gc::set_deferred_rc(deferred_rc != "0", std::stoul(std::string(deferred_max)));
+
+    std::string_view lazy_free = setting.first("gc_lazy_free").value_or("0");
+    std::string_view lazy_free_slice = setting.first("gc_lazy_free_slice").value_or("1000");
+    gc::set_lazy_free(lazy_free != "0", std::stoul(std::string(lazy_free_slice)));
+
     if(argc > 1 && argv[1] == std::string_view("irc")) {
         std::time_t start_time = std::time(nullptr);
         int delay = 10;
         while(true) {
             try {
                 start_time = std::time(nullptr);
-                run_irc(setting, c, i);
+                run_irc(setting, m, c, i);
                 return 0;
             } catch(boost::system::system_error &e) {
                 std::cerr << "boost exception: " << e.what() << std::endl;
@@ -104,6 +236,8 @@ int main(int argc, char* argv[]) {
     while(true) {
         try {
             //gc::collect();
+            while(!gc::free_slice()) {}
+
             std::string line;
             std::cout << "Input: ";
             std::getline(std::cin, line);
@@ -111,6 +245,27 @@ int main(int argc, char* argv[]) {
             if(line == "quit")
                 return 0;
 
+            if(line == "!gcstats") {
+                std::cout << gc_stats_summary() << std::endl;
+                continue;
+            }
+
+            // "!heap json" dumps the whole profile
+            if(line == "!heap json") {
+                std::cout << m.profile_globals().to_json() << std::endl;
+                continue;
+            }
+
+            if(line == "!heap" || starts_with(line, "!heap ")) {
+                std::cout << heap_summary(m, line) << std::endl;
+                continue;
+            }
+
+            if(line == "!budget" || starts_with(line, "!budget ")) {
+                std::cout << allocation_budget(i, line) << std::endl;
+                continue;
+            }
+
             bool make_global = starts_with(line, "!set ");
             if(make_global)
                 line = line.substr(5);
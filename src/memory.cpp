@@ -2,7 +2,9 @@
 #include "gc.hpp"
 #include "memory.hpp"
 #include "object.hpp"
+#include "stack_util.hpp"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
@@ -10,8 +12,8 @@
 
 
 void memory::push_frame(std::size_t current_pos, std::size_t current_operand_count, func_ref func, array_ref params) {
-    gc::anchor_ptr<func_type> func_anchor = func;
-    gc::anchor_ptr<gcvector<object>> params_anchor = params;
+    gc::root<func_ref> func_root = func;
+    gc::root<array_ref> params_root = params;
 
     memory_buffer<debug> &buffer = func->definition->code;
     buffer.seek_abs(0);
@@ -22,8 +24,8 @@ void memory::push_frame(std::size_t current_pos, std::size_t current_operand_cou
     std::size_t code_size = buffer.size() - capture_count;
 
     for(std::size_t i = params->size(); i < param_count; ++i) {
-        gc::anchor_ptr<object> param = make_lvalue();
-        params->push_back(object(param));
+        gc::root<var_ref> param = make_lvalue();
+        params->push_back(object(*param));
     }
 
     for(std::size_t i = 0; i < local_var_count; ++i)
@@ -61,6 +63,13 @@ void memory::clear_stack() {
 }
 
 
+void memory::shrink_stacks(std::size_t max_entries) {
+    shrink_stack(*temps_stack, max_entries);
+    shrink_stack(*local_var_stack, max_entries);
+    shrink_stack(*frame_stack, max_entries);
+}
+
+
 var_ref memory::get_local_var(std::size_t index) const {
     if(debug && frame_stack->empty())
         debug_throw("get_local_var: frame_stack empty!");
@@ -101,14 +110,55 @@ var_ref memory::get_local_var(std::size_t index) const {
 }
 
 
-var_ref memory::get_or_add_global(const std::string &name) {
+const var_ref &memory::get_or_add_global(const std::string &name) {
     if(auto it = globals->find(name); it != globals->end())
         return it->second;
-    else
-        return globals->try_emplace(name, make_lvalue()).first->second;
+
+    // growing the table may collect, and the new node isn't reachable from globals until it's linked in
+    gc::root<var_ref> var = make_lvalue();
+    return globals->try_emplace(name, *var).first->second;
 }
 
 
 bool memory::has_global(const std::string &name) const {
     return globals->count(name);
 }
+
+
+globals_profile memory::profile_globals() {
+    std::vector<var_ref> vars;
+    globals_profile result;
+
+    for(auto &entry : *globals) {
+        vars.push_back(entry.second);
+        result.globals.push_back({entry.first, {}});
+    }
+
+    gc::heap_profile heap = gc::profile(vars);
+    for(std::size_t i = 0; i < vars.size(); ++i)
+        result.globals[i].size = heap.roots[i];
+    result.shared_objects = heap.shared_objects;
+    result.shared_bytes = heap.shared_bytes;
+
+    std::stable_sort(result.globals.begin(), result.globals.end(), [](const global_size &left, const global_size &right) {
+        return left.size.retained_bytes > right.size.retained_bytes;
+    });
+    return result;
+}
+
+
+// global names are identifiers, so they need no escaping
+std::string globals_profile::to_json() const {
+    using std::to_string;
+
+    std::string json = "{\"globals\":[";
+    for(const global_size &g : globals) {
+        if(&g != &globals.front())
+            json += ',';
+        json += "{\"name\":\"" + g.name + "\",\"shallow_bytes\":" + to_string(g.size.shallow_bytes)
+            + ",\"retained_objects\":" + to_string(g.size.retained_objects) 
+            + ",\"retained_bytes\":" + to_string(g.size.retained_bytes) + '}';
+    }
+    return json + "],\"shared_objects\":" + to_string(shared_objects) 
+        + ",\"shared_bytes\":" + to_string(shared_bytes) + '}';
+}
@@ -1,21 +1,135 @@
 #include "object.hpp"
 #include "conversion.hpp"
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <utility>
 #include <variant>
 
 
-object::value_type object::value() const {
-    return std::visit([](auto &&v) -> value_type {
+namespace {
+
+
+template<typename T>
+std::uint64_t checked_address(T *p) {
+    std::uint64_t address = reinterpret_cast<std::uintptr_t>(p);
+    if(debug && (address >> 48))
+        debug_throw("object: address doesn't fit in 48 bits");
+    return address;
+}
+
+
+}  // namespace
+
+
+std::uint64_t object::encode(type &&v) {
+    return std::visit([](auto &&v) -> std::uint64_t {
         using T = std::decay_t<decltype(v)>;
-        if constexpr(std::is_same_v<T, var_ref> || std::is_same_v<T, lvalue_ref>)
-            return v->value();
+        if constexpr(std::is_same_v<T, std::monostate>) {
+            return null_word;
+        } else if constexpr(std::is_same_v<T, std::int64_t>) {
+            if(v >= -(std::int64_t(1) << 47) && v < (std::int64_t(1) << 47))
+                return int_tag | (static_cast<std::uint64_t>(v) & payload_mask);
+            return checked_address(gc::detail::release_node(gc::make_ptr<std::int64_t>(v))) | int_kind;
+        } else if constexpr(std::is_same_v<T, std::uint64_t>) {
+            if(v <= payload_mask)
+                return uint_tag | v;
+            return checked_address(gc::detail::release_node(gc::make_ptr<std::uint64_t>(v))) | uint_kind;
+        } else if constexpr(std::is_same_v<T, double>) {
+            std::uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            if(std::isnan(v))
+                bits = (bits & (std::uint64_t(1) << 63)) | 0x7ff8000000000000;
+            return bits + double_offset;
+        } else if constexpr(std::is_same_v<T, lvalue_ref>) {
+            return lvalue_tag | checked_address(v);
+        } else {
+            std::uint64_t kind = std::is_same_v<T, string_ref> ? string_kind 
+                : std::is_same_v<T, array_ref> ? array_kind
+                : std::is_same_v<T, map_ref> ? map_kind
+                : std::is_same_v<T, func_ref> ? func_kind
+                : var_kind;
+            return checked_address(gc::detail::release_node(std::move(v))) | kind;
+        }
+    }, std::move(v));
+}
+
+
+// value_type leaves out var_ref and lvalue_ref, which value() takes care of itself
+template<typename Variant>
+Variant object::decode() const {
+    switch(word >> 48) {
+    case 0:
+        if(word == null_word)
+            return std::monostate();
+
+        switch(word & kind_mask) {
+        case string_kind: return gc::detail::ptr_from_node<string_type>(get_node());
+        case array_kind: return gc::detail::ptr_from_node<gcvector<object>>(get_node());
+        case map_kind: return gc::detail::ptr_from_node<gcmap>(get_node());
+        case func_kind: return gc::detail::ptr_from_node<func_type>(get_node());
+        case int_kind: return node_value<std::int64_t>(get_node());
+        case uint_kind: return node_value<std::uint64_t>(get_node());
+        default:
+            if constexpr(std::is_same_v<Variant, type>)
+                return gc::detail::ptr_from_node<object>(get_node());
+            else
+                throw std::logic_error("object::decode: unexpected var_ref");
+        }
+    case lvalue_tag >> 48:
+        if constexpr(std::is_same_v<Variant, type>)
+            return reinterpret_cast<lvalue_ref>(word & payload_mask);
         else
-            return v;
-    }, val);
+            throw std::logic_error("object::decode: unexpected lvalue_ref");
+    case int_tag >> 48:
+        return static_cast<std::int64_t>(word << 16) >> 16;
+    case uint_tag >> 48:
+        return word & payload_mask;
+    default:
+        return to_double(word);
+    }
+}
+
+
+object::type object::get() const { return decode<type>(); }
+
+
+object::value_type object::value() const {
+    if((word >> 48) == 0 && (word & kind_mask) == var_kind && gc::detail::untag(get_node()))
+        return node_value<object>(get_node()).value();
+    if((word >> 48) == (lvalue_tag >> 48))
+        return reinterpret_cast<lvalue_ref>(word & payload_mask)->value();
+    return decode<value_type>();
+}
+
+
+object *object::target() const {
+    if((word >> 48) == 0 && (word & kind_mask) == var_kind && gc::detail::untag(get_node()))
+        return &node_value<object>(get_node());
+    if((word >> 48) == (lvalue_tag >> 48))
+        return reinterpret_cast<lvalue_ref>(word & payload_mask);
+    return nullptr;
+}
+
+
+object object::take_value() {
+    if(object *t = target())
+        return *t;
+    return std::move(*this);
+}
+
+
+string_type *object::unshared_string(const object &also) {
+    if(!is_node(word) || (word & kind_mask) != string_kind)
+        return nullptr;
+    gc::detail::node *n = gc::detail::untag(get_node());
+    std::uint32_t refs = also.word == word ? 2 : 1;
+    return n->ref_count == refs ? &node_value<string_type>(n) : nullptr;
 }
 
 
@@ -31,32 +145,46 @@ object::non_null_type object::non_null_value() const {
 
 
 std::optional<gcstring> object::to_optional_string(std::size_t depth, std::size_t *count, bool format) const {
-    return std::visit([=](auto &&v) { 
-        return ::to_optional_string(std::forward<decltype(v)>(v), depth, count, format); 
-    }, value());
+    return visit([=](auto &&v) { 
+        return ::to_optional_string(v, depth, count, format); 
+    });
 }
 
 gcstring object::to_string(std::size_t depth, std::size_t *count, bool format) const {
     return to_optional_string(depth, count, format).value_or("null");
 }
 
+string_ref object::to_string_ref() const {
+    if(object *t = target())
+        return t->to_string_ref();
+    if(is_node(word) && (word & kind_mask) == string_kind && gc::detail::untag(get_node()))
+        return gc::detail::ptr_from_node<string_type>(get_node());
+    return make_string(to_string());
+}
+
 
 object::int_type object::to_int() const {
-    return std::visit([](auto &&arg) -> int_type { 
-        return ::to_int(std::forward<decltype(arg)>(arg)); 
-    }, non_null_value());
+    return visit([](auto &&arg) -> int_type { 
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr(std::is_same_v<T, std::monostate>)
+            throw std::runtime_error("unexpected null value");
+        else
+            return ::to_int(arg); 
+    });
 }
 
 bool object::to_bool() const {
-    return std::visit([](auto &&v) {
+    return visit([](auto &&v) {
         using T = std::decay_t<decltype(v)>;
         if constexpr(std::is_same_v<T, std::monostate>)
             return false;
-        else if constexpr(std::is_same_v<T, string_ref>)
-            return !v->empty();
-        else
+        else if constexpr(std::is_same_v<T, string_type>)
+            return !v.empty();
+        else if constexpr(std::is_arithmetic_v<T>)
             return !!v;
-    }, value());
+        else
+            return true;
+    });
 }
 
 /*
@@ -0,0 +1,375 @@
+#include "gc.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// asan's malloc has a layout of its own
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define GC_TEST_GLIBC_MALLOC
+#include <malloc.h>
+#endif
+
+
+// regression tests for the collector on its own. every test runs in a heap of its own. prints the
+// checks that fail and exits with 1 if any did
+
+
+int failures = 0;
+
+void check(bool ok, const char *test, const char *what) {
+    if(!ok) {
+        std::printf("FAIL %s: %s\n", test, what);
+        ++failures;
+    }
+}
+
+
+int destroyed = 0;
+
+struct small_node {
+    ~small_node() { ++destroyed; }
+
+    gc::ptr<struct large_node> next;
+
+    void transverse(gc::action &act);
+};
+
+// too big for the pools, so it gets a page of its own
+struct large_node {
+    ~large_node() { ++destroyed; }
+
+    gc::ptr<small_node> child;
+    char padding[2048] = {};
+
+    void transverse(gc::action &act) { act(child); }
+};
+
+void small_node::transverse(gc::action &act) { act(next); }
+
+
+// a large node's mark has to be cleared between collections, or the second one skips tracing it
+void large_node_survives_collections() {
+    const char *test = "large_node_survives_collections";
+    destroyed = 0;
+    {
+        gc::anchor_ptr<large_node> root = gc::make_ptr<large_node>();
+        root->child = gc::make_ptr<small_node>();
+        gc::collect();
+        gc::collect();
+        gc::collect();
+        check(destroyed == 0, test, "a reachable node was destroyed");
+        check(gc::object_count() == 2, test, "object_count changed");
+    }
+    gc::collect();
+    check(destroyed == 2, test, "the nodes weren't destroyed once unreachable");
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+}
+
+
+void cycle_through_large_node_is_freed() {
+    const char *test = "cycle_through_large_node_is_freed";
+    destroyed = 0;
+    gc::collect();
+    {
+        gc::ptr<large_node> large = gc::make_ptr<large_node>();
+        large->child = gc::make_ptr<small_node>();
+        large->child->next = large;
+    }
+    gc::collect();
+    gc::collect();
+    check(destroyed == 2, test, "the cycle wasn't destroyed");
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+}
+
+
+struct throwing_node {
+    throwing_node() { throw std::runtime_error("throwing_node"); }
+};
+
+
+// only what was actually allocated counts against the budget
+void failed_allocation_isnt_charged() {
+    const char *test = "failed_allocation_isnt_charged";
+    std::size_t before = gc::get_bytes_allocated();
+    gc::set_allocation_budget(1024);
+
+    try {
+        gc::make_ptr<large_node>();
+        check(false, test, "a node over the budget was made");
+    } catch(gc::allocation_budget_exceeded &) {}
+    check(gc::get_bytes_allocated() == before, test, "a node over the budget was charged");
+
+    try {
+        gc::make_ptr<throwing_node>();
+    } catch(std::runtime_error &) {}
+    check(gc::get_bytes_allocated() == before, test, "a node whose constructor threw was charged");
+
+    gc::ptr<small_node> fits = gc::make_ptr<small_node>();
+    check(gc::get_bytes_allocated() > before, test, "a node that was made wasn't charged");
+    gc::clear_allocation_budget();
+}
+
+
+struct box {
+    gc::ptr<small_node> item;
+
+    void transverse(gc::action &act) { act(item); }
+};
+
+
+// a node only a deferred ptr refers to when marking starts has to survive that ptr going away
+// before its anchor is scanned, once it's been copied into something marking has already been through
+void deferred_ptr_dropped_while_marking() {
+    const char *test = "deferred_ptr_dropped_while_marking";
+    destroyed = 0;
+    gc::set_deferred_rc(true, 1000);
+    gc::set_incremental(true);
+    gc::set_incremental_start(0);
+    gc::set_slice_budget(1, std::chrono::seconds(1));
+    {
+        // anchors are scanned newest first, so holder is done before deferred
+        gc::anchor<std::vector<gc::ptr<small_node>>> deferred;
+        deferred->push_back(gc::defer(gc::make_ptr<small_node>()));
+        gc::anchor_ptr<box> holder = gc::make_ptr<box>();
+
+        gc::step();     // scans holder
+        gc::step();     // and marks the box
+        holder->item = deferred->back();
+        deferred->clear();
+        while(gc::get_stats().collections == 0)
+            gc::step();
+
+        check(destroyed == 0, test, "a reachable node was destroyed");
+        check(gc::object_count() == 2, test, "object_count changed");
+    }
+    gc::set_incremental(false);
+    gc::collect();
+    check(destroyed == 1, test, "the node wasn't destroyed once unreachable");
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+}
+
+
+// a node only deferred ptrs refer to waits in the zct: reconcile() counts them and keeps it, and it's
+// freed once they're gone, by reconcile() while other deferred ptrs are alive or right away once none are
+void deferred_ptr_survives_reconcile() {
+    const char *test = "deferred_ptr_survives_reconcile";
+    destroyed = 0;
+    gc::set_deferred_rc(true, 1000);
+    {
+        gc::anchor<std::vector<gc::ptr<small_node>>> stack;
+        stack->push_back(gc::defer(gc::make_ptr<small_node>()));
+        stack->push_back(gc::defer(gc::make_ptr<small_node>()));
+        check(destroyed == 0, test, "a node with a deferred ptr was freed");
+
+        gc::detail::current_heap->reconcile();
+        check(destroyed == 0, test, "reconcile freed a node with a deferred ptr");
+        check(gc::object_count() == 2, test, "object_count isn't 2 after reconcile");
+
+        stack->pop_back();
+        check(destroyed == 0, test, "a node was freed while ptrs were still being deferred");
+        gc::detail::current_heap->reconcile();
+        check(destroyed == 1, test, "reconcile didn't free the node whose deferred ptr went");
+        check(gc::object_count() == 1, test, "object_count isn't 1 after the second reconcile");
+
+        stack->pop_back();
+        check(destroyed == 2, test, "the last node wasn't freed with the last deferred ptr");
+    }
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+    gc::set_deferred_rc(false, 0);
+}
+
+
+// a ring of a large and a small node, with nothing else referring to it
+gc::ptr<large_node> make_ring() {
+    gc::ptr<large_node> large = gc::make_ptr<large_node>();
+    large->child = gc::make_ptr<small_node>();
+    large->child->next = large;
+    return large;
+}
+
+
+// trial deletion frees a ring nothing refers to, and leaves one an anchor refers to alone
+void collect_cycles_frees_only_dead_cycles() {
+    const char *test = "collect_cycles_frees_only_dead_cycles";
+    destroyed = 0;
+    gc::set_cycle_collection(true, 1000);
+    {
+        gc::anchor_ptr<large_node> root = make_ring();
+        make_ring();
+        check(gc::object_count() == 4, test, "a ring was freed by refcounting");
+
+        gc::collect_cycles();
+        check(destroyed == 2, test, "the dead ring wasn't freed");
+        check(gc::object_count() == 2, test, "object_count isn't 2");
+        check(root->child && root->child->next == root, test, "the anchored ring was changed");
+
+        // once its anchor lets go, the anchored one is a candidate too
+        root = nullptr;
+        gc::collect_cycles();
+        check(destroyed == 4, test, "the ring wasn't freed once unanchored");
+    }
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+    check(gc::get_stats().cycle_objects_freed == 4, test, "cycle_objects_freed isn't 4");
+    gc::set_cycle_collection(false, 0);
+}
+
+
+// lock() gives null once the target is gone, whether refcounting or a collection freed it, and the
+// heap's table of weak blocks only has entries for live targets
+void weak_ptr_expires_with_target() {
+    const char *test = "weak_ptr_expires_with_target";
+    destroyed = 0;
+    std::unordered_map<gc::detail::node*, gc::detail::weak_block*> &blocks = gc::detail::current_heap->weak_blocks;
+
+    gc::ptr<small_node> counted = gc::make_ptr<small_node>();
+    gc::weak_ptr<small_node> weak_counted = counted;
+    gc::weak_ptr<large_node> weak_ring = make_ring();
+    gc::weak_ptr<large_node> copy = weak_ring;
+    check(blocks.size() == 2, test, "two targets don't have two weak blocks");
+    check(weak_ring.lock() && weak_counted.lock() == counted, test, "lock() gave null for a live target");
+
+    counted = nullptr;
+    check(!weak_counted.lock() && weak_counted.expired(), test, "lock() gave a target refcounting freed");
+    gc::collect();
+    check(destroyed == 3, test, "the targets weren't freed");
+    check(!weak_ring.lock() && !copy.lock(), test, "lock() gave a target a collection freed");
+    check(blocks.empty(), test, "the weak blocks of freed targets are still in the table");
+    check(weak_ring == copy, test, "weak_ptrs to the same target no longer compare equal");
+
+    // and the last weak_ptr to a live target takes its entry with it
+    gc::anchor_ptr<small_node> live = gc::make_ptr<small_node>();
+    {
+        gc::weak_ptr<small_node> weak = live;
+        gc::weak_ptr<small_node> other = weak;
+        check(blocks.size() == 1, test, "a live target's weak block isn't in the table");
+    }
+    check(blocks.empty(), test, "a weak block was left in the table after its last weak_ptr");
+}
+
+
+// a target that's garbage when marking starts is kept if lock() gives a ptr to it before the sweep,
+// even when that ptr is only copied into something marking has already been through. the copy
+// doesn't shade anything, so lock() has to
+void weak_ptr_lock_while_marking() {
+    const char *test = "weak_ptr_lock_while_marking";
+    destroyed = 0;
+    gc::set_incremental(true);
+    gc::set_incremental_start(0);
+    gc::set_slice_budget(1, std::chrono::seconds(1));
+    {
+        gc::weak_ptr<large_node> weak = make_ring();
+        gc::anchor<std::vector<gc::ptr<small_node>>> live(std::in_place, 10);     // keeps marking busy for a few steps
+        for(gc::ptr<small_node> &p : *live)
+            p = gc::make_ptr<small_node>();
+        // anchors are scanned newest first, so holder is done before live
+        gc::anchor<std::vector<gc::ptr<large_node>>> holder;
+
+        gc::step();     // scans holder
+        gc::step();
+        // locked is kept until the cycle ends: dropping it would shade the ring too
+        gc::ptr<large_node> locked = weak.lock();
+        check(locked != nullptr, test, "lock() gave null before the sweep");
+        holder->push_back(locked);
+        while(gc::get_stats().collections == 0)
+            gc::step();
+
+        check(destroyed == 0, test, "a node lock() gave was destroyed");
+        check(weak.lock() != nullptr, test, "lock() gave null after the cycle");
+    }
+    gc::set_incremental(false);
+    gc::collect();
+    check(destroyed == 12, test, "the nodes weren't destroyed once unreachable");
+    check(gc::object_count() == 0, test, "object_count isn't 0");
+}
+
+
+// two roots with a node each of their own and a subgraph of two nodes they share: each root retains
+// its own, the shared ones are only counted in the shared totals, and a null root retains nothing
+void profile_splits_shared_subgraph() {
+    const char *test = "profile_splits_shared_subgraph";
+    const std::size_t small_size = gc::detail::get_memory_used_for<small_node>();
+    const std::size_t large_size = gc::detail::get_memory_used_for<large_node>();
+
+    gc::ptr<large_node> shared = gc::make_ptr<large_node>();
+    shared->child = gc::make_ptr<small_node>();
+    std::vector<gc::ptr<large_node>> roots = {gc::make_ptr<large_node>(), gc::make_ptr<large_node>(), nullptr};
+    for(std::size_t i = 0; i < 2; ++i) {
+        roots[i]->child = gc::make_ptr<small_node>();
+        roots[i]->child->next = shared;
+    }
+
+    gc::heap_profile profile = gc::profile(roots);
+    check(profile.roots.size() == 3, test, "there isn't a result for every root");
+    for(std::size_t i = 0; i < 2; ++i) {
+        const gc::retained_size &root = profile.roots[i];
+        check(root.shallow_bytes == large_size, test, "a root's shallow size isn't its own");
+        check(root.retained_objects == 2, test, "a root doesn't retain just itself and its child");
+        check(root.retained_bytes == large_size + small_size, test, "a root's retained size is off");
+    }
+    check(profile.roots[2].shallow_bytes == 0 && profile.roots[2].retained_objects == 0
+            && profile.roots[2].retained_bytes == 0, test, "a null root retains something");
+    check(profile.shared_objects == 2, test, "the shared subgraph isn't two objects");
+    check(profile.shared_bytes == large_size + small_size, test, "the shared size is off");
+
+    // gc::allocator storage a value owns counts toward its size
+    std::vector<gc::ptr<std::vector<int, gc::allocator<int>>>> vectors = {
+        gc::make_ptr<std::vector<int, gc::allocator<int>>>(100)};
+    std::size_t vector_size = gc::detail::get_memory_used_for<std::vector<int, gc::allocator<int>>>()
+        + gc::detail::malloc_allocation_size(vectors[0]->capacity() * sizeof(int));
+    gc::heap_profile with_storage = gc::profile(vectors);
+    check(with_storage.roots[0].shallow_bytes == vector_size, test, "a vector's storage isn't in its shallow size");
+    check(with_storage.roots[0].retained_bytes == vector_size, test, "a vector's storage isn't in its retained size");
+}
+
+
+// memory_used goes up by what malloc_allocation_size says a block takes, and that is what the block
+// really takes: the whole bin, malloc's chunk, or whole pages
+void allocation_size_matches_usable_size() {
+    const char *test = "allocation_size_matches_usable_size";
+    gc::allocator<char> alloc;
+    for(std::size_t size : {1, 16, 17, 100, 4096, 4097, 5000, 65536, 131071, 131072, 200000}) {
+        std::size_t expected = gc::detail::malloc_allocation_size(size);
+        check(expected >= size, test, "a block is counted as smaller than it is");
+
+        std::size_t before = gc::get_memory_used();
+        char *p = alloc.allocate(size);
+        check(gc::get_memory_used() - before == expected, test, "memory_used didn't go up by the block's size");
+        alloc.deallocate(p, size);
+        check(gc::get_memory_used() == before, test, "memory_used didn't go back down");
+
+        if(size <= gc::detail::max_block_size)
+            check(expected < 2 * size || expected == gc::detail::min_block_size, test, "a bin is bigger than it needs to be");
+        else if(size >= gc::detail::large_allocation_size)
+            check(expected % 4096 == 0 && expected - size < 4096, test, "a large block isn't counted in whole pages");
+#ifdef GC_TEST_GLIBC_MALLOC
+        else {
+            // glibc's usable size leaves out the size word in front
+            void *m = std::malloc(size);
+            check(malloc_usable_size(m) + sizeof(std::size_t) == expected, test, "malloc's chunk is a different size");
+            std::free(m);
+        }
+#endif
+    }
+}
+
+
+int main() {
+    for(void (*test)() : {large_node_survives_collections, cycle_through_large_node_is_freed,
+            failed_allocation_isnt_charged, deferred_ptr_dropped_while_marking,
+            allocation_size_matches_usable_size, collect_cycles_frees_only_dead_cycles,
+            deferred_ptr_survives_reconcile, weak_ptr_expires_with_target, weak_ptr_lock_while_marking,
+            profile_splits_shared_subgraph}) {
+        gc::heap h;
+        gc::heap_scope scope(h);
+        test();
+    }
+
+    if(failures == 0)
+        std::printf("gc_test: all passed\n");
+    return failures ? 1 : 0;
+}
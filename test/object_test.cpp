@@ -0,0 +1,228 @@
+#include "gc.hpp"
+#include "object.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+
+// regression tests for the values scripts work with, on their own. every test runs in a heap of its
+// own. prints the checks that fail and exits with 1 if any did
+
+
+int failures = 0;
+
+void check(bool ok, const char *test, const char *what) {
+    if(!ok) {
+        std::printf("FAIL %s: %s\n", test, what);
+        ++failures;
+    }
+}
+
+
+std::string key(std::size_t i) { return "key" + std::to_string(i); }
+
+
+bool holds_int(const object &obj, std::int64_t i) {
+    object::value_type value = obj.value();
+    const std::int64_t *held = std::get_if<std::int64_t>(&value);
+    return held && *held == i;
+}
+
+
+// get() gives back the alternative and value the object was made with, and so does a copy of it
+template<typename T>
+bool round_trips(const T &v) {
+    object obj(v);
+    object copy = obj;
+    object::type got = obj.get();
+    object::type copied = copy.get();
+    const T *held = std::get_if<T>(&got);
+    const T *held_copy = std::get_if<T>(&copied);
+    return held && held_copy && *held == v && *held_copy == v;
+}
+
+
+bool same_bits(double left, double right) { return std::memcmp(&left, &right, sizeof(double)) == 0; }
+
+
+// integers either side of the 48 bits that fit in the word, and the ends of their range, which get
+// nodes of their own
+void integers_round_trip() {
+    const char *test = "integers_round_trip";
+    const std::int64_t small = std::int64_t(1) << 47;
+    for(std::int64_t i : {std::int64_t(0), std::int64_t(1), std::int64_t(-1), small - 1, -small, small, -small - 1,
+            std::numeric_limits<std::int64_t>::max(), std::numeric_limits<std::int64_t>::min()}) {
+        check(round_trips(i), test, ("int64 " + std::to_string(i)).c_str());
+    }
+
+    const std::uint64_t payload = (std::uint64_t(1) << 48) - 1;
+    for(std::uint64_t u : {std::uint64_t(0), std::uint64_t(1), payload, payload + 1,
+            std::numeric_limits<std::uint64_t>::max()}) {
+        check(round_trips(u), test, ("uint64 " + std::to_string(u)).c_str());
+    }
+
+    // the boxed ones are freed with their objects
+    check(gc::object_count() == 0, test, "a boxed integer outlived its object");
+}
+
+
+// doubles keep their bits, except that a nan is kept as the quiet nan of its sign
+void doubles_round_trip() {
+    const char *test = "doubles_round_trip";
+    for(double d : {0.0, -0.0, 1.5, -1e300, std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest(),
+            std::numeric_limits<double>::min(), std::numeric_limits<double>::denorm_min(),
+            std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()}) {
+        object::type got = object(d).get();
+        const double *held = std::get_if<double>(&got);
+        check(held && same_bits(*held, d), test, ("double " + std::to_string(d)).c_str());
+    }
+
+    for(double nan : {std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::quiet_NaN(),
+            std::numeric_limits<double>::signaling_NaN(), std::nan("0x12345")}) {
+        object::type got = object(nan).get();
+        const double *held = std::get_if<double>(&got);
+        check(held && std::isnan(*held) && std::signbit(*held) == std::signbit(nan), test,
+                "a nan didn't stay a nan of its sign");
+    }
+}
+
+
+// every kind of node comes back as the same node, null ptrs of every kind included, and a var_ref or
+// lvalue_ref reads through to what it refers to
+void nodes_round_trip() {
+    const char *test = "nodes_round_trip";
+    check(std::holds_alternative<std::monostate>(object().get()), test, "a default object isn't null");
+    check(std::holds_alternative<std::monostate>(object(std::monostate()).get()), test, "null didn't stay null");
+
+    check(round_trips(make_string("abc")), test, "string_ref");
+    check(round_trips(make_array()), test, "array_ref");
+    check(round_trips(make_map()), test, "map_ref");
+    check(round_trips(gc::make_ptr<func_type>(std::shared_ptr<func_def>(), gcvector<var_ref>())), test, "func_ref");
+    check(round_trips(make_lvalue(std::int64_t(5))), test, "var_ref");
+    object target(std::int64_t(7));
+    check(round_trips(&target), test, "lvalue_ref");
+
+    check(round_trips(string_ref()), test, "null string_ref");
+    check(round_trips(array_ref()), test, "null array_ref");
+    check(round_trips(map_ref()), test, "null map_ref");
+    check(round_trips(func_ref()), test, "null func_ref");
+
+    check(holds_int(object(make_lvalue(std::int64_t(5))), 5), test, "a var_ref's value isn't its target's");
+    check(holds_int(object(&target), 7), test, "an lvalue_ref's value isn't its target's");
+    check(gc::object_count() == 0, test, "a node outlived its objects");
+}
+
+
+// entries come back in the order their keys were first added. adding a key that's there already
+// leaves its entry where it was (nothing can be removed, so there's no reinserting after an erase)
+void map_keeps_insertion_order() {
+    const char *test = "map_keeps_insertion_order";
+    gc::anchor_ptr<gcmap> map = make_map();
+    std::vector<std::string> order = {"zebra", "apple", "mango", "", "banana"};
+    for(std::size_t i = 0; i < order.size(); ++i)
+        map->try_emplace(make_string(order[i]), std::int64_t(i));
+
+    auto [it, inserted] = map->try_emplace(make_string("apple"), std::int64_t(100));
+    check(!inserted, test, "a key that's there was added again");
+    check(holds_int(it->second, 1), test, "adding a key that's there changed its value");
+    check(map->size() == order.size(), test, "size changed when a key that's there was added");
+
+    std::size_t i = 0;
+    for(const auto &[k, v] : *map) {
+        check(i < order.size() && k->view() == order[i], test, "the keys came back out of order");
+        check(holds_int(v, i), test, "a key came back with another's value");
+        ++i;
+    }
+    check(i == order.size(), test, "iteration didn't visit every entry");
+}
+
+
+// growing through several rehashes and blocks, every key is still found, in order, and a key that
+// was never added isn't
+void map_grows() {
+    const char *test = "map_grows";
+    gc::anchor_ptr<gcmap> map = make_map();
+    const std::size_t count = 20000;
+    for(std::size_t i = 0; i < count; ++i)
+        map->try_emplace(make_string(key(i)), std::int64_t(i));
+    check(map->size() == count, test, "size isn't the number of keys added");
+
+    bool all_found = true;
+    for(std::size_t i = 0; i < count; ++i) {
+        auto it = map->find(std::string_view(key(i)));
+        all_found = all_found && it != map->end() && holds_int(it->second, i);
+    }
+    check(all_found, test, "a key wasn't found after the map grew");
+    check(map->find(std::string_view("key-1")) == map->end(), test, "a key that wasn't added was found");
+
+    std::size_t i = 0;
+    bool in_order = true;
+    for(const auto &entry : *map)
+        in_order = in_order && entry.first->view() == key(i++);
+    check(in_order && i == count, test, "the entries came back out of order after the map grew");
+}
+
+
+// adding entries never moves the ones already there
+void map_references_stay_valid() {
+    const char *test = "map_references_stay_valid";
+    gc::anchor_ptr<gcmap> map = make_map();
+    std::vector<std::pair<string_type*, object*>> first;
+    for(std::size_t i = 0; i < 10; ++i) {
+        auto it = map->try_emplace(make_string(key(i)), std::int64_t(i)).first;
+        first.emplace_back(it->first.get(), &it->second);
+    }
+
+    for(std::size_t i = 10; i < 10000; ++i)
+        map->try_emplace(make_string(key(i)), std::int64_t(i));
+
+    for(std::size_t i = 0; i < first.size(); ++i) {
+        auto it = map->find(std::string_view(key(i)));
+        check(it->first.get() == first[i].first && &it->second == first[i].second, test, "an entry moved");
+        check(holds_int(*first[i].second, i), test, "an entry's value changed");
+    }
+}
+
+
+// a map that outgrows the memory limit throws, and leaves nothing counted once it's gone
+void map_over_memory_limit_throws() {
+    const char *test = "map_over_memory_limit_throws";
+    gc::collect();
+    std::size_t before = gc::get_memory_used();
+    gc::set_memory_limit(before + 256 * 1024);
+    {
+        gc::anchor_ptr<gcmap> map = make_map();
+        try {
+            for(int i = 0; i < 1000000; ++i)
+                map->try_emplace(make_string("key" + std::to_string(i)), std::int64_t(i));
+            check(false, test, "a million entries fit in 256 KiB");
+        } catch(gc::memory_limit_exceeded &) {}
+        check(map->size() > 0, test, "nothing was added before the limit");
+        check(gc::get_memory_used() <= gc::get_memory_limit(), test, "memory_used is over the limit");
+    }
+    gc::collect();
+    check(gc::get_memory_used() == before, test, "memory_used didn't go back down");
+}
+
+
+int main() {
+    for(void (*test)() : {integers_round_trip, doubles_round_trip, nodes_round_trip, map_keeps_insertion_order,
+            map_grows, map_references_stay_valid, map_over_memory_limit_throws}) {
+        gc::heap h;
+        gc::heap_scope scope(h);
+        test();
+    }
+
+    if(failures == 0)
+        std::printf("object_test: all passed\n");
+    return failures ? 1 : 0;
+}
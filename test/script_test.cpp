@@ -0,0 +1,52 @@
+#include "compiler.hpp"
+#include "gc.hpp"
+#include "interpreter.hpp"
+#include "memory.hpp"
+#include "tokenizer.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+
+// regression tests that run scripts through the compiler and interpreter and check the value they
+// end with. prints the scripts that don't and exits with 1 if any didn't
+
+
+struct script_case {
+    const char *code;
+    const char *expected;
+};
+
+
+const script_case cases[] = {
+    // += appends in place, but the value last_value still holds mustn't change with it
+    {"ss = \"abc\"; if(ss += \"d\") {}", "abc"},
+    {"aa = [\"abc\"]; aa[0]; if(aa[0] += \"z\") {}", "abc"},
+    {"ss = \"abc\"; tt = ss; ss += \"d\"; tt", "abc"},
+    {"ss = \"abc\"; ss += \"d\"; ss += ss; ss", "abcdabcd"},
+    {"ss = \"abc\"; if(ss += \"d\") {} ss", "abcd"},
+    {"ss = \"\"; ii = 0; while(ii < 5) { ss += \"x\"; ++ii; } ss", "xxxxx"},
+    {"ss = \"\"; ii = 0; while(ii < 3) { ++ii; ss += \"a\"; ss += \"b\"; } ss", "ababab"},
+};
+
+
+int main() {
+    int failures = 0;
+    memory m;
+    compiler c(&m);
+    interpreter i(&m, 100);
+
+    for(const script_case &test : cases) {
+        tokenizer t(test.code);
+        std::string result = i.execute(c.compile(t.tokens(), t.source(), false));
+        if(result != test.expected) {
+            std::printf("FAIL %s\n  expected: %s\n  got: %s\n", test.code, test.expected, result.c_str());
+            ++failures;
+        }
+    }
+
+    if(failures == 0)
+        std::printf("script_test: all passed\n");
+    return failures ? 1 : 0;
+}